@@ -0,0 +1,681 @@
+/*
+ * Unit tests, run by make check.
+ *
+ * The header defines data as well as declaring it, so the game can't be linked twice:
+ * it's included whole instead, with its main renamed.
+ */
+
+#define main tetrodropper_main
+#include "../tetrodropper.c"
+#undef main
+
+
+int failures = 0;
+
+#define Check(__check_condition)					\
+  do {									\
+    if (!(__check_condition)) {						\
+      fprintf(stderr, "%s: %s: %d: %s\n", __FILE__, __func__, __LINE__,	\
+	      #__check_condition);					\
+      failures += 1;							\
+    }									\
+  } while (0)
+
+
+
+/*
+ * Helpers
+ */
+
+
+/* A fresh empty file; the caller unlinks it */
+void temp_file(char *path, size_t len)
+{
+  const char *dir = getenv("TMPDIR");
+  snprintf(path, len, "%s/tetrodropper-check-XXXXXX", dir != NULL ? dir : "/tmp");
+
+  int fd = mkstemp(path);
+  Die(fd < 0);
+  close(fd);
+}
+
+
+unsigned char *read_file(const char *path, size_t *size)
+{
+  FILE *f = fopen(path, "rb");
+  Die(f == NULL);
+
+  Die(fseek(f, 0, SEEK_END) < 0);
+  long len = ftell(f);
+  rewind(f);
+
+  unsigned char *data = malloc(len + 1);
+  Die(data == NULL);
+  Die(fread(data, 1, len, f) != (size_t)len);
+  fclose(f);
+
+  *size = len;
+  return data;
+}
+
+
+void write_file(const char *path, const unsigned char *data, size_t size)
+{
+  FILE *f = fopen(path, "wb");
+  Die(f == NULL);
+  Die(fwrite(data, 1, size, f) != size);
+  Die(fclose(f) != 0);
+}
+
+
+
+/*
+ * Event log
+ */
+
+
+void test_varint(void)
+{
+  const int64_t values[] = { 0, 1, -1, 63, -64, 64, -65, 300, -300, 1000000, INT32_MAX,
+			     INT32_MIN, INT64_MAX, INT64_MIN };
+
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    unsigned char buf[10];
+    size_t n = encode_varint(buf, values[i]);
+
+    int64_t value = 0;
+    Check(n >= 1 && n <= 10);
+    Check(decode_varint(buf, n, &value) == n);
+    Check(value == values[i]);
+
+    /* Cut short, it's malformed */
+    Check(decode_varint(buf, n - 1, &value) == 0);
+  }
+
+  /* Zigzag: small magnitudes of either sign take a single byte */
+  unsigned char buf[10];
+  Check(encode_varint(buf, -64) == 1);
+  Check(encode_varint(buf, 63) == 1);
+  Check(encode_varint(buf, 64) == 2);
+
+  /* Eleven continuation bytes are never a varint */
+  unsigned char endless[11];
+  memset(endless, 0x80, sizeof(endless));
+  int64_t value;
+  Check(decode_varint(endless, sizeof(endless), &value) == 0);
+}
+
+
+void test_event_log(void)
+{
+  char path[PATH_MAX];
+  temp_file(path, sizeof(path));
+
+  /* Two games, the second by another player */
+  struct EventLog *log = open_event_log(path);
+
+  log_event(log, EV_GAME_START, 10., 1700000000L);
+  log_event(log, EV_SPAWN, 10., (long)T_TYPE);
+  log_event(log, EV_LOCK, 10.5, (long)T_TYPE, 0L, 15L, 4L);
+  log_event(log, EV_SPAWN, 10.5, (long)I_TYPE);
+  log_event(log, EV_LOCK, 12., (long)I_TYPE, 1L, 14L, 0L);
+  log_event(log, EV_ROWS, 12., 4L);
+  log_event(log, EV_SCORE, 12., 1200L);
+  log_event(log, EV_GAMEOVER, 13., 1200L, ('A' << 16 | 'B' << 8 | 'C') + 0L);
+
+  log_event(log, EV_GAME_START, 20., 1700000100L);
+  log_event(log, EV_SPAWN, 20., (long)O_TYPE);
+  log_event(log, EV_LOCK, 21., (long)O_TYPE, 0L, 15L, 5L);
+  log_event(log, EV_GAMEOVER, 22., 0L, ('X' << 16 | 'Y' << 8 | 'Z') + 0L);
+
+  close_event_log(log);
+
+  size_t size;
+  unsigned char *data = read_file(path, &size);
+
+  struct PlayerStats *players = NULL;
+  int num_players = 0;
+
+  Check(scan_event_log(data, size, &players, &num_players));
+  Check(num_players == 2);
+
+  if (num_players == 2) {
+    Check(strcmp(players[0].name, "ABC") == 0);
+    Check(players[0].games == 1);
+    Check(players[0].pieces == 2);
+    Check(players[0].total_score == 1200);
+    Check(players[0].type_count[T_TYPE] == 1 && players[0].type_count[I_TYPE] == 1);
+    Check(players[0].clear_count[4] == 1);
+    Check(fabs(players[0].piece_time - 2.) < 1e-6);
+
+    Check(strcmp(players[1].name, "XYZ") == 0);
+    Check(players[1].pieces == 1 && players[1].best_score == 0);
+  }
+
+  /* A truncated record, a wrong signature or an unknown tag spoil the whole log */
+  struct PlayerStats *rejected = NULL;
+  int num_rejected = 0;
+
+  Check(!scan_event_log(data, size - 1, &rejected, &num_rejected));
+
+  data[0] ^= 0xFF;
+  Check(!scan_event_log(data, size, &rejected, &num_rejected));
+  data[0] ^= 0xFF;
+
+  data[sizeof(EVENT_LOG_MAGIC)] = MAX_EVENT_TYPE;
+  Check(!scan_event_log(data, size, &rejected, &num_rejected));
+
+  free(rejected);
+  free(players);
+  free(data);
+  unlink(path);
+}
+
+
+
+/*
+ * Bots and simulation
+ */
+
+
+void test_next_random(void)
+{
+  /* The reference SplitMix64 outputs from a zero state */
+  const uint64_t expected[] = { 0xE220A8397B1DCDAFull, 0x6E789E6AA1B965F4ull,
+				0x06C45D188009454Full, 0xF88BB8A8724C81ECull,
+				0x1B39896A51A8749Bull };
+
+  uint64_t state = 0;
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+    Check(next_random(&state) == expected[i]);
+  }
+
+  /* Every type comes up, and nothing else */
+  long count[1 + MAX_TYPES] = { 0 };
+  state = 42;
+  for (int i = 0; i < 7000; ++i) {
+    enum TetrominoType type = random_type(&state);
+    Check(type >= 1 && type <= MAX_TYPES);
+    if (type >= 1 && type <= MAX_TYPES) count[type] += 1;
+  }
+  for (int type = 1; type <= MAX_TYPES; ++type) Check(count[type] > 800 && count[type] < 1200);
+
+  /* Games of a tournament get distinct seeds, the same in every run */
+  Check(game_seed(7, 0) == game_seed(7, 0));
+  Check(game_seed(7, 0) != game_seed(7, 1));
+}
+
+
+void test_simulate_game(void)
+{
+  /* A seed replays the same game */
+  struct GameResult a = simulate_game(&builtin_policies[0], 7, 300, NULL);
+  struct GameResult b = simulate_game(&builtin_policies[0], 7, 300, NULL);
+
+  Check(a.score == b.score && a.lines == b.lines && a.pieces == b.pieces);
+  Check(a.pieces > 0 && a.pieces <= 300);
+}
+
+
+
+/* The plain cell by cell evaluation, as it was before the bitboards */
+void scalar_features(struct GameBoard *board, struct Tetromino *landed,
+		     double features[NUM_FEATURES])
+{
+  int height = board->height;
+  int width = board->width;
+
+  bool cells[height][width];
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) cells[y][x] = board_row(board, y)[x] != 0;
+  }
+  for (int i = 0; i < MAX_BLOCKS; ++i) cells[landed->square[i].y][landed->square[i].x] = true;
+
+  int lines = 0;
+
+  for (int y = height - 1; y >= 0; --y) {
+    bool full = true;
+    for (int x = 0; x < width && full; ++x) full = cells[y][x];
+
+    if (full) {
+      lines += 1;
+    } else if (lines > 0) {
+      memcpy(cells[y + lines], cells[y], width * sizeof(cells[0][0]));
+    }
+  }
+  for (int y = 0; y < lines; ++y) memset(cells[y], 0, width * sizeof(cells[0][0]));
+
+  int column_height[width];
+  for (int x = 0; x < width; ++x) {
+    column_height[x] = 0;
+    for (int y = 0; y < height && column_height[x] == 0; ++y) {
+      if (cells[y][x]) column_height[x] = height - y;
+    }
+  }
+
+  memset(features, 0, NUM_FEATURES * sizeof(features[0]));
+
+  for (int x = 0; x < width; ++x) {
+    features[FEAT_HEIGHT] += column_height[x];
+    if (x > 0) features[FEAT_BUMPINESS] += abs(column_height[x] - column_height[x - 1]);
+
+    for (int y = 0; y < height; ++y) {
+      bool open = y < height - column_height[x];
+      if (!open && !cells[y][x]) features[FEAT_HOLES] += 1;
+      if (open && (x == 0 || cells[y][x - 1]) && (x == width - 1 || cells[y][x + 1])) {
+	features[FEAT_WELLS] += 1;
+      }
+      if (y > 0 && cells[y][x] != cells[y - 1][x]) features[FEAT_COL_TRANSITIONS] += 1;
+    }
+    if (!cells[height - 1][x]) features[FEAT_COL_TRANSITIONS] += 1;
+  }
+
+  for (int y = 0; y < height; ++y) {
+    bool previous = true;
+    for (int x = 0; x < width; ++x) {
+      if (cells[y][x] != previous) features[FEAT_ROW_TRANSITIONS] += 1;
+      previous = cells[y][x];
+    }
+    if (!previous) features[FEAT_ROW_TRANSITIONS] += 1;
+  }
+
+  features[FEAT_LINES] = lines;
+  features[FEAT_LANDING] = height - (landed->min_y + landed->max_y) / 2.;
+}
+
+
+void test_feature_batch(void)
+{
+  uint64_t rng = 1;
+
+  /* Ragged stacks with holes, some rows one block short of a clear */
+  for (int round = 0; round < 200; ++round) {
+
+    struct Game game;
+    game_init(&game, round, NULL, NULL);
+
+    int top = game.board->height / 2 + next_random(&rng) % (game.board->height / 2);
+
+    for (int y = top; y < game.board->height; ++y) {
+      int gap = next_random(&rng) % BOARD_WIDTH;
+      bool short_one = next_random(&rng) % 3 == 0;
+      for (int x = 0; x < BOARD_WIDTH; ++x) {
+	bool filled = short_one ? x != gap : next_random(&rng) % 4 != 0;
+	board_row(game.board, y)[x] = filled ? 1 + x % MAX_TYPES : 0;
+      }
+    }
+    game.board->stack_top = top;
+
+    init_tetromino(&game.current, random_type(&rng), SPAWN_HEIGHT, SPAWN_WIDTH, NULL);
+
+    struct Candidate candidates[MAX_CANDIDATES];
+    int n = enumerate_placements(&game, candidates);
+    Check(n > 0);
+
+    double features[MAX_CANDIDATES][NUM_FEATURES];
+    evaluate_candidates(game.board, candidates, n, features);
+
+    for (int i = 0; i < n; ++i) {
+      double expected[NUM_FEATURES];
+      scalar_features(game.board, &candidates[i].landed, expected);
+      for (int k = 0; k < NUM_FEATURES; ++k) Check(features[i][k] == expected[k]);
+    }
+
+    free_gameboard(game.board);
+  }
+}
+
+
+
+
+/*
+ * Score Index
+ */
+
+
+/*
+ * Heap order on priorities, and subtree sizes that add up; the size of the subtree. Ties
+ * may sit on either side after a rotation: their order is checked through the pages.
+ */
+uint32_t check_score_subtree(struct ScoreNode *nodes, uint32_t n)
+{
+  if (n == 0) return 0;
+
+  uint32_t left = nodes[n].left, right = nodes[n].right;
+  Check(left == 0 || (nodes[left].priority <= nodes[n].priority
+		      && nodes[left].score >= nodes[n].score));
+  Check(right == 0 || (nodes[right].priority <= nodes[n].priority
+		       && nodes[right].score <= nodes[n].score));
+
+  uint32_t size = 1 + check_score_subtree(nodes, left) + check_score_subtree(nodes, right);
+  Check(nodes[n].size == size);
+
+  return size;
+}
+
+
+void test_score_index(void)
+{
+  char path[PATH_MAX];
+  temp_file(path, sizeof(path));
+
+  struct ScoreIndex *index = open_score_index(path);
+  Check(index != NULL);
+  if (index == NULL) return;
+
+  /* Past the initial capacity, and with plenty of ties */
+  enum { NUM_SCORES = 3 * SCORE_INDEX_INITIAL };
+  static long scores[NUM_SCORES];
+  uint64_t rng = 5;
+
+  for (int i = 0; i < NUM_SCORES; ++i) {
+    scores[i] = 100 * (next_random(&rng) % 500);
+
+    long expected = 1;
+    for (int j = 0; j < i; ++j) expected += scores[j] >= scores[i];
+
+    long total = 0;
+    Check(score_index_insert(index, "CHK", scores[i], i, &total) == expected);
+    Check(total == i + 1);
+  }
+
+  Check(score_index_count(index) == NUM_SCORES);
+  Check(check_score_subtree(index->nodes, index->header->root) == NUM_SCORES);
+
+  /* Rank of a new score: after every higher or equal one */
+  for (long score = -100; score <= 50000; score += 50) {
+    long expected = 1;
+    for (int j = 0; j < NUM_SCORES; ++j) expected += scores[j] >= score;
+    Check(score_index_rank(index, score) == expected);
+  }
+
+  /* Selection: highest first, ties in the order they were played */
+  static struct ScoreNode page[NUM_SCORES];
+  long total = 0;
+  Check(score_index_page(index, 0, NUM_SCORES, page, &total) == NUM_SCORES);
+  Check(total == NUM_SCORES);
+
+  for (int k = 1; k < NUM_SCORES; ++k) {
+    Check(page[k - 1].score > page[k].score
+	  || (page[k - 1].score == page[k].score && page[k - 1].time < page[k].time));
+  }
+
+  struct ScoreNode middle[10];
+  Check(score_index_page(index, NUM_SCORES / 2, 10, middle, NULL) == 10);
+  Check(memcmp(middle, &page[NUM_SCORES / 2], sizeof(middle)) == 0);
+  Check(score_index_page(index, NUM_SCORES - 3, 10, middle, NULL) == 3);
+
+  /* An insertion cut short: the next process to open the index relinks it */
+  index->header->dirty = 1;
+  index->header->root = 0;
+  for (int n = 1; n <= NUM_SCORES; ++n) index->nodes[n].left = index->nodes[n].right = n;
+  close_score_index(index);
+
+  index = open_score_index(path);
+  Check(index != NULL);
+  if (index == NULL) return;
+
+  Check(index->header->dirty == 0);
+  Check(check_score_subtree(index->nodes, index->header->root) == NUM_SCORES);
+
+  static struct ScoreNode relinked[NUM_SCORES];
+  Check(score_index_page(index, 0, NUM_SCORES, relinked, NULL) == NUM_SCORES);
+  for (int k = 0; k < NUM_SCORES; ++k) {
+    Check(relinked[k].score == page[k].score && relinked[k].time == page[k].time);
+  }
+
+  close_score_index(index);
+  unlink(path);
+}
+
+
+
+/*
+ * Suspend and Resume
+ */
+
+
+/* Some pieces into a bot game, with the falling piece partway down */
+void play_some_pieces(struct Game *game, uint64_t seed, int pieces)
+{
+  game_init(game, seed, NULL, NULL);
+  uint64_t rng = ~seed;
+
+  for (int i = 0; i < pieces && !game->gameover; ++i) {
+    apply_placement(game, heuristic_policy(game, builtin_policies[0].weights, &rng));
+    game_lock_piece(game, NULL, NULL);
+  }
+
+  move_tetromino(&game->current, game->board, +2, -1, NULL);
+}
+
+
+void test_save_game(void)
+{
+  char path[PATH_MAX];
+  temp_file(path, sizeof(path));
+
+  struct Game game;
+  play_some_pieces(&game, 3, 40);
+  Check(!game.gameover && game.score > 0);
+
+  /* Round trip: the same game, and only once */
+  Check(save_game(&game, 0.25, path));
+
+  struct Game loaded;
+  struct Difficulty difficulty;
+  Check(load_game(&loaded, &difficulty, path));
+  Check(access(path, F_OK) != 0);
+
+  Check(loaded.board->height == game.board->height);
+  for (int y = 0; y < game.board->height; ++y) {
+    Check(memcmp(board_row(loaded.board, y), board_row(game.board, y), BOARD_WIDTH) == 0);
+  }
+  Check(loaded.board->stack_top == game.board->stack_top);
+  Check(memcmp(loaded.current.square, game.current.square, sizeof(game.current.square)) == 0);
+  Check(loaded.current.rotation_state == game.current.rotation_state);
+  Check(loaded.preview.type == game.preview.type);
+  Check(loaded.rng == game.rng);
+  Check(loaded.score == game.score && loaded.lines == game.lines);
+  Check(loaded.pieces == game.pieces);
+  Check(loaded.threshold == 0.25);
+  Check(loaded.difficulty == &difficulty);
+  Check(memcmp(&difficulty, game.difficulty, sizeof(difficulty)) == 0);
+
+  free_gameboard(loaded.board);
+
+  /* Damage: anything the checksum catches, or that it was recomputed over */
+  enum { UNDAMAGED, CUT_SHORT, FLIPPED_BIT, BAD_VERSION, BAD_CELL, PIECE_IN_STACK, PIECE_TORN,
+	 BAD_PREVIEW, NO_SCORE_MODULUS, NAN_SPEED, NEGATIVE_SCORE, LATE_GRAVITY,
+	 NUM_DAMAGES };
+
+  for (int damage = 0; damage < NUM_DAMAGES; ++damage) {
+
+    Check(save_game(&game, 0.25, path));
+
+    size_t size;
+    unsigned char *data = read_file(path, &size);
+    struct SavedGame *saved = (struct SavedGame *)data;
+    uint8_t *rows = data + sizeof(*saved);
+    int bottom = saved->height - 1;
+
+    switch (damage) {
+    case UNDAMAGED: break;
+    case CUT_SHORT: size -= 1; break;
+    case FLIPPED_BIT: rows[bottom * BOARD_WIDTH] ^= 1; break;
+    case BAD_VERSION: saved->version += 1; break;
+    case BAD_CELL: rows[bottom * BOARD_WIDTH] = DEAD_TYPE + 1; break;
+    case PIECE_IN_STACK:
+      for (int i = 0; i < MAX_BLOCKS; ++i) saved->current.square[i].y += bottom;
+      saved->current.center_y += bottom;
+      break;
+    case PIECE_TORN: saved->current.square[0].x += 2; break;
+    case BAD_PREVIEW: saved->preview.type = 0; break;
+    case NO_SCORE_MODULUS: saved->difficulty.score_modulus = 0; break;
+    case NAN_SPEED: saved->difficulty.initial_speed = NAN; break;
+    case NEGATIVE_SCORE: saved->difficulty.line_scores[1] = -100; break;
+    case LATE_GRAVITY: saved->remaining = 2. / saved->difficulty.initial_speed; break;
+    }
+
+    /* A damaged bit stays damaged; everything else gets a matching checksum again */
+    if (damage != CUT_SHORT && damage != FLIPPED_BIT) {
+      saved->checksum = crc32(0L, (const Bytef *)&saved->height,
+			      sizeof(*saved) - offsetof(struct SavedGame, height));
+      saved->checksum = crc32(saved->checksum, rows, saved->height * BOARD_WIDTH);
+    }
+
+    write_file(path, data, size);
+    free(data);
+
+    bool ok = load_game(&loaded, &difficulty, path);
+    Check(ok == (damage == UNDAMAGED));
+    if (ok) free_gameboard(loaded.board);
+  }
+
+  free_gameboard(game.board);
+  unlink(path);
+}
+
+
+
+
+/*
+ * Versus
+ */
+
+
+/*
+ * A whole match, player 1's inputs arriving 'delay' frames late (0: in time to step their
+ * frame). Until then they are guessed, and each wrong guess rolls the match back, as
+ * receive_versus_packets does.
+ */
+struct Versus *play_versus(const uint8_t (*inputs)[2], int frames, int delay)
+{
+  struct Versus *vs = calloc(1, sizeof(*vs));
+  Die(vs == NULL);
+
+  vs->nonce = 0x1234;
+  start_versus(vs, 0x5678);
+
+  for (int f = 0; f <= frames; ++f) {
+
+    uint32_t known = Min(Max(f + 1 - delay, 0), frames);
+    uint32_t mismatch = UINT32_MAX;
+
+    while (vs->num_inputs[1] < known) {
+      uint32_t frame = vs->num_inputs[1];
+      if (frame < vs->state.frame && inputs[frame][1] != versus_input(vs, 1, frame)) {
+	mismatch = Min(mismatch, frame);
+      }
+      vs->inputs[1][frame % VERSUS_INPUT_WINDOW] = inputs[frame][1];
+      vs->num_inputs[1] += 1;
+    }
+
+    if (mismatch != UINT32_MAX) roll_back_versus(vs, mismatch);
+
+    if (f == frames) break;
+
+    vs->inputs[0][vs->num_inputs[0]++ % VERSUS_INPUT_WINDOW] = inputs[f][0];
+    advance_versus(vs);
+  }
+
+  /* The inputs still on their way */
+  uint32_t mismatch = UINT32_MAX;
+
+  while (vs->num_inputs[1] < (uint32_t)frames) {
+    uint32_t frame = vs->num_inputs[1];
+    if (inputs[frame][1] != versus_input(vs, 1, frame)) mismatch = Min(mismatch, frame);
+    vs->inputs[1][frame % VERSUS_INPUT_WINDOW] = inputs[frame][1];
+    vs->num_inputs[1] += 1;
+  }
+
+  if (mismatch != UINT32_MAX) roll_back_versus(vs, mismatch);
+
+  return vs;
+}
+
+
+void close_played_versus(struct Versus *vs)
+{
+  for (int p = 0; p < 2; ++p) {
+    free_gameboard(vs->state.player[p].game.board);
+    for (int i = 0; i <= VERSUS_MAX_ROLLBACK; ++i) {
+      free_gameboard(vs->saved[i].player[p].game.board);
+    }
+  }
+
+  free(vs);
+}
+
+
+void test_versus_replay(void)
+{
+  /* A key every few frames for both, the kind that makes garbage rare but pieces move */
+  enum { FRAMES = 40 * VERSUS_TICK_HZ };
+  static uint8_t inputs[FRAMES][2];
+  uint64_t rng = 11;
+
+  for (int f = 0; f < FRAMES; ++f) {
+    for (int p = 0; p < 2; ++p) {
+      uint64_t r = next_random(&rng);
+      inputs[f][p] = r % 4 == 0 ? (r >> 8) & (VS_ROTATE | VS_LEFT | VS_DOWN | VS_RIGHT) : 0;
+    }
+  }
+
+  struct Versus *reference = play_versus(inputs, FRAMES, 0);
+  Check(reference->rollbacks == 0);
+  Check(reference->state.frame == FRAMES);
+
+  const int delays[] = { 1, 7, VERSUS_MAX_ROLLBACK };
+
+  for (size_t i = 0; i < sizeof(delays) / sizeof(delays[0]); ++i) {
+
+    struct Versus *vs = play_versus(inputs, FRAMES, delays[i]);
+    Check(vs->rollbacks > 0 && vs->max_depth <= VERSUS_MAX_ROLLBACK);
+    Check(vs->state.frame == FRAMES);
+
+    /* Rolled back and replayed, the match ends exactly as if no input had been late */
+    for (int p = 0; p < 2; ++p) {
+      struct VersusPlayer *a = &vs->state.player[p], *b = &reference->state.player[p];
+
+      Check(versus_checksum(&a->game) == versus_checksum(&b->game));
+      Check(a->game.score == b->game.score && a->game.lines == b->game.lines);
+      Check(a->game.pieces == b->game.pieces && a->game.rng == b->game.rng);
+      Check(memcmp(a->game.current.square, b->game.current.square,
+		   sizeof(a->game.current.square)) == 0);
+      Check(a->game.gameover == b->game.gameover && a->lost_frame == b->lost_frame);
+      Check(a->incoming == b->incoming && a->garbage_rng == b->garbage_rng);
+    }
+
+    close_played_versus(vs);
+  }
+
+  /* The inputs do matter: the two players' games went their own ways */
+  Check(reference->state.player[0].game.pieces > 10);
+  Check(versus_checksum(&reference->state.player[0].game)
+	!= versus_checksum(&reference->state.player[1].game));
+
+  close_played_versus(reference);
+}
+
+
+
+int main(void)
+{
+  test_varint();
+  test_event_log();
+  test_next_random();
+  test_simulate_game();
+  test_feature_batch();
+  test_score_index();
+  test_save_game();
+  test_versus_replay();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
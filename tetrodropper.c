@@ -2,11 +2,128 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ncurses.h>
 #include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <arpa/inet.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+
+
+struct Options options = {
+  .games = DEFAULT_GAMES,
+  .seed = 1,
+  .max_pieces = DEFAULT_MAX_PIECES,
+  .input_rate = DEFAULT_INPUT_RATE,
+  .generations = DEFAULT_GENERATIONS,
+  .population = DEFAULT_POPULATION,
+  .board_height = BOARD_HEIGHT,
+  .difficulty = DEFAULT_DIFFICULTY
+};
+
+#ifdef TRACE
+struct TraceState trace_state = { 0 };
+#endif
+
+/* Set by SIGTERM during a game, which is then suspended rather than lost */
+volatile sig_atomic_t suspend_requested = 0;
+
+/* Mapped on first use, see pc_database() */
+struct PcDatabase *pc_db = NULL;
+
+/* Resources used by the interactive session, phase by phase */
+struct Accounting accounting = { .games = NULL, .num_games = 0, .cap_games = 0 };
+
+const char *phase_names[NUM_PHASES] = {
+  [PHASE_TITLE] = "title",
+  [PHASE_GAME] = "game",
+  [PHASE_SCORES] = "scores"
+};
+
+/* Built-in bots. Weights are in enum Feature order */
+const struct Policy builtin_policies[] = {
+  { "dellacherie", heuristic_policy, { 0., 0., -7.899, -3.386, -3.218, -9.349, 3.418, -4.500 } },
+  { "simple", heuristic_policy, { -0.510, -0.184, -0.357, 0., 0., 0., 0.761, 0. } },
+  { "random", random_policy, { 0. } },
+  { "perfect-clear", pc_policy, { 0., 0., -7.899, -3.386, -3.218, -9.349, 3.418, -4.500 } }
+};
+
+/* The options setting each difficulty parameter, in enum DifficultyParam order */
+const char *difficulty_param_names[NUM_DIFFICULTY_PARAMS] = {
+  [PARAM_INITIAL_SPEED] = "--initial-speed",
+  [PARAM_SPEED_INCREMENT] = "--speed-increment",
+  [PARAM_SCORE_MODULUS] = "--score-modulus",
+  [PARAM_LINE_SCORES] = "--line-scores"
+};
+
+/* The build's rules, the only ones whose games go to the rankings */
+const struct Difficulty default_difficulty = DEFAULT_DIFFICULTY;
+
+/* Garbage rows sent to the opponent by a lock clearing as many lines */
+const int garbage_from_lines[1 + MAX_BLOCKS] = { 0, 0, 1, 2, 4 };
+
+/* Where each trajectory column comes from in struct Transition, and how wide it is */
+const size_t column_offset[NUM_TRAJECTORY_COLUMNS] = {
+  [COL_BOARD] = offsetof(struct Transition, board),
+  [COL_EPISODE] = offsetof(struct Transition, episode),
+  [COL_STEP] = offsetof(struct Transition, step),
+  [COL_REWARD] = offsetof(struct Transition, reward),
+  [COL_PIECE] = offsetof(struct Transition, piece),
+  [COL_PREVIEW] = offsetof(struct Transition, preview),
+  [COL_ROTATION] = offsetof(struct Transition, rotation),
+  [COL_X] = offsetof(struct Transition, x),
+  [COL_Y] = offsetof(struct Transition, y),
+  [COL_DONE] = offsetof(struct Transition, done)
+};
+
+const size_t column_width[NUM_TRAJECTORY_COLUMNS] = {
+  [COL_BOARD] = sizeof(((struct Transition *)0)->board),
+  [COL_EPISODE] = 4,
+  [COL_STEP] = 4,
+  [COL_REWARD] = 4,
+  [COL_PIECE] = 1,
+  [COL_PREVIEW] = 1,
+  [COL_ROTATION] = 1,
+  [COL_X] = 1,
+  [COL_Y] = 1,
+  [COL_DONE] = 1
+};
+
+#define NUM_BUILTIN_POLICIES	((int)(sizeof(builtin_policies) / sizeof(builtin_policies[0])))
+
+/* Number of fields following the time delta, for each event tag */
+const int event_num_fields[MAX_EVENT_TYPE] = {
+  [EV_GAME_START] = 1,
+  [EV_SPAWN] = 1,
+  [EV_LOCK] = 4,
+  [EV_ROWS] = 1,
+  [EV_SCORE] = 1,
+  [EV_SPEED] = 1,
+  [EV_GAMEOVER] = 2
+};
 
 
 
@@ -30,6 +147,12 @@ void initialize(void)
   nodelay(stdscr, true);
   curs_set(0);
 
+  init_colors();
+}
+
+
+void init_colors(void)
+{
   if (has_colors()) {
 
     start_color();
@@ -55,15 +178,168 @@ void cleanup(void)
 
 
 
+#ifdef TRACE
+
+/*
+ * Tracing
+ */
+
+
+uint64_t trace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc(); /* Ticks, converted to time only when dumping */
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+
+uint64_t monotonic_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+void trace_start(void)
+{
+  /* Before any ring is published, so that the dump never sees a ring without a clock */
+  trace_state.start_ticks = trace_clock();
+  trace_state.start_ns = monotonic_ns();
+  Die(pthread_key_create(&trace_state.key, &trace_unregister) != 0);
+  atexit(&trace_dump);
+}
+
+
+void trace_unregister(void *ring)
+{
+  /* The events stay for the dump, the ring for the next thread that starts */
+  atomic_store_explicit(&((struct TraceRing *)ring)->idle, true, memory_order_release);
+}
+
+
+struct TraceRing *trace_register(void)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, &trace_start);
+
+  struct TraceRing *ring = NULL;
+  int num_rings = Min(atomic_load(&trace_state.num_rings), TRACE_MAX_THREADS);
+
+  /* Batch modes start threads over and over: take over the ring of one that has exited */
+  for (int r = 0; ring == NULL && r < num_rings; ++r) {
+    struct TraceRing *idle = atomic_load_explicit(&trace_state.rings[r], memory_order_acquire);
+    bool expected = true;
+    if (idle != NULL && atomic_compare_exchange_strong(&idle->idle, &expected, false)) ring = idle;
+  }
+
+  if (ring == NULL) {
+
+    int slot = atomic_fetch_add(&trace_state.num_rings, 1);
+    if (slot >= TRACE_MAX_THREADS) return NULL; /* Too many threads at once: not traced */
+
+    ring = calloc(1, sizeof(*ring));
+    Die(ring == NULL);
+
+    ring->tid = slot + 1;
+    atomic_store_explicit(&trace_state.rings[slot], ring, memory_order_release);
+  }
+
+  pthread_setspecific(trace_state.key, ring);
+
+  return ring;
+}
+
+
+void trace_event(const char *name, char phase)
+{
+  static __thread struct TraceRing *ring = NULL;
+  static __thread bool registered = false;
+
+  if (__builtin_expect(!registered, 0)) {
+    ring = trace_register();
+    registered = true;
+  }
+
+  if (ring == NULL) return;
+
+  /* Only this thread writes its ring, oldest events are overwritten */
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  struct TraceEvent *e = &ring->events[head % TRACE_RING_LEN];
+
+  e->ticks = trace_clock();
+  e->name = name;
+  e->phase = phase;
+
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+void trace_dump(void)
+{
+  char *path = getenv("TETRODROPPER_TRACE");
+  FILE *out = fopen(path != NULL ? path : TRACE_FILE_NAME, "w");
+  if (out == NULL) return;
+
+  /* Ticks to nanoseconds, from the time elapsed since the first event on both clocks */
+  double ns_per_tick = (double)(monotonic_ns() - trace_state.start_ns)
+    / (double)Max(trace_clock() - trace_state.start_ticks, 1);
+
+  fprintf(out, "{\"traceEvents\":[\n");
+
+  bool first = true;
+  int num_rings = Min(atomic_load(&trace_state.num_rings), TRACE_MAX_THREADS);
+
+  for (int r = 0; r < num_rings; ++r) {
+
+    struct TraceRing *ring = atomic_load_explicit(&trace_state.rings[r], memory_order_acquire);
+    if (ring == NULL) continue;
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t tail = head > TRACE_RING_LEN ? head - TRACE_RING_LEN : 0;
+
+    for (uint64_t i = tail; i < head; ++i) {
+
+      struct TraceEvent *e = &ring->events[i % TRACE_RING_LEN];
+      double us = 1e-3 * ns_per_tick * (double)(int64_t)(e->ticks - trace_state.start_ticks);
+
+      fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+	      first ? "" : ",\n", e->name, e->phase, us, (int)getpid(), ring->tid);
+      first = false;
+    }
+  }
+
+  fprintf(out, "\n]}\n");
+  fclose(out);
+}
+
+#endif
+
+
+
 /* 
  * Tetrodropper Logic
  */
 
 
 
-enum TetrominoType random_type(void)
+uint64_t next_random(uint64_t *state)
+{
+  /* SplitMix64: tiny state, so that games can be replayed from a single seed */
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+
+enum TetrominoType random_type(uint64_t *state)
 {
-  return 1 + rand() % MAX_TYPES;
+  return 1 + next_random(state) % MAX_TYPES;
 }
 
 
@@ -72,6 +348,15 @@ struct Tetromino *new_tetromino(enum TetrominoType type, int spawn_y, int spawn_
   struct Tetromino *t = malloc(sizeof(*t));
   Die(t == NULL);
 
+  init_tetromino(t, type, spawn_y, spawn_x, win);
+
+  return t;
+}
+
+
+void init_tetromino(struct Tetromino *t, enum TetrominoType type, int spawn_y, int spawn_x,
+		    WINDOW *win)
+{
   /* Initialize with the required template */
   switch (type) {
 
@@ -87,9 +372,6 @@ struct Tetromino *new_tetromino(enum TetrominoType type, int spawn_y, int spawn_
 
   /* Translate the tetromino to the spawning position */
   reposition_tetromino(t, spawn_y, spawn_x, NULL, win);
-  
-  /* Ready */
-  return t;
 }
 
 
@@ -98,17 +380,14 @@ struct GameBoard *new_gameboard(int height, int width)
   struct GameBoard *board = malloc(sizeof(*board));
   Die(board == NULL);
 
-  board->is_filled = malloc(height * sizeof(*board->is_filled));
-  Die(board->is_filled == NULL);
-
-  /* Initialize every row with zeroes (false) */
-  for (size_t i = 0; i < height; ++i) {
-    board->is_filled[i] = calloc(width, sizeof(board->is_filled[0][0]));
-    Die(board->is_filled[i] == NULL);
-  }
+  /* Initialize every row with zeroes (empty) */
+  board->cells = calloc((size_t)height * width, sizeof(*board->cells));
+  Die(board->cells == NULL);
   
   board->height = height;
   board->width = width;
+  board->top = 0;
+  board->stack_top = height;
 
   return board;
 }
@@ -116,11 +395,48 @@ struct GameBoard *new_gameboard(int height, int width)
 
 void free_gameboard(struct GameBoard *board)
 {
-  free(board->is_filled);
+  free(board->cells);
   free(board);
 }
 
 
+uint8_t *board_row(struct GameBoard *board, int y)
+{
+  int slot = board->top + y;
+  if (slot >= board->height) slot -= board->height;
+
+  return board->cells + (size_t)slot * board->width;
+}
+
+
+void copy_gameboard(struct GameBoard *dst, const struct GameBoard *src)
+{
+  /* Boards of the same size only */
+  memcpy(dst->cells, src->cells, (size_t)src->height * src->width);
+  dst->top = src->top;
+  dst->stack_top = src->stack_top;
+}
+
+
+void game_init(struct Game *game, uint64_t seed, WINDOW *board_win, WINDOW *preview_win)
+{
+  game->board = new_gameboard(options.board_height, BOARD_WIDTH);
+  game->rng = seed;
+  game->difficulty = &options.difficulty;
+  game->threshold = 1. / game->difficulty->initial_speed; /* Relative: callers add the clock */
+  game->score = 0;
+  game->lines = 0;
+  game->pieces = 0;
+  game->view_top = 0;
+  game->gameover = false;
+
+  init_tetromino(&game->current, random_type(&game->rng), SPAWN_HEIGHT, SPAWN_WIDTH,
+		 board_win);
+  init_tetromino(&game->preview, random_type(&game->rng), PREVIEW_WIN_SIDE / 2 - 1,
+		 PREVIEW_WIN_SIDE / 2, preview_win);
+}
+
+
 
 /*
  * Game Mechanics
@@ -149,7 +465,7 @@ enum CollisionType point_collision(struct Point p, struct GameBoard *board)
 
     return FLOOR_COLLISION;
 
-  } else if (board->is_filled[p.y][p.x]) { /* The test order guarantees indices not OOB */
+  } else if (board_row(board, p.y)[p.x]) { /* The test order guarantees indices not OOB */
 
     return DEAD_BLOCK_COLLISION;
     
@@ -197,6 +513,8 @@ enum CollisionType rotate_tetromino(struct Tetromino *t, struct GameBoard *board
   /* The 'O' tetromino doesn't rotate */
   if (t->num_states == 1) return NO_COLLISION;
 
+  TraceBegin("rotate_tetromino");
+
   /* Rotation is clockwise only for already rotated 2-state tetrominoes */
   int counter_clockwise = t->num_states != 2 || t->rotation_state != 1;
 
@@ -221,15 +539,38 @@ enum CollisionType rotate_tetromino(struct Tetromino *t, struct GameBoard *board
 
     if (win != NULL) draw_tetromino(win, t, 0, 0);
   }
+
+  TraceEnd("rotate_tetromino");
   
   return c;
 }
 
 
 
+int drop_distance(struct Tetromino *t, struct GameBoard *board)
+{
+  int distance = board->height;
+
+  /* Free rows under each block, down to the stack or the floor: the piece falls the least */
+  for (int i = 0; i < MAX_BLOCKS; ++i) {
+
+    int x = t->square[i].x;
+    int y = Max(t->square[i].y + 1, board->stack_top); /* Nothing to hit above the stack */
+
+    while (y < board->height && !board_row(board, y)[x]) ++y;
+
+    distance = Min(distance, y - t->square[i].y - 1);
+  }
+
+  return distance;
+}
+
+
 enum CollisionType move_tetromino(struct Tetromino *t, struct GameBoard *board, int dy, int dx,
 				  WINDOW *win)
 {
+  TraceBegin("move_tetromino");
+
   /* New tentative tetromino */
   struct Tetromino new_t = *t;
 
@@ -253,6 +594,8 @@ enum CollisionType move_tetromino(struct Tetromino *t, struct GameBoard *board,
     if (win != NULL) draw_tetromino(win, t, 0, 0);
   }
 
+  TraceEnd("move_tetromino");
+
   return coll;
 }
 
@@ -279,41 +622,100 @@ void reposition_tetromino(struct Tetromino *t, int y, int x, WINDOW *from, WINDO
 
 void record_dead_blocks(struct Tetromino *t, struct GameBoard *board)
 {
+  TraceBegin("record_dead_blocks");
+
   for (int i = 0; i < MAX_BLOCKS; ++i) {
-    board->is_filled[t->square[i].y][t->square[i].x] = true;
+    board_row(board, t->square[i].y)[t->square[i].x] = t->type;
   }
+
+  board->stack_top = Min(board->stack_top, t->min_y);
+
+  TraceEnd("record_dead_blocks");
 }
 
 
 
 bool row_is_full(struct GameBoard *board, int row)
 {
+  uint8_t *cells = board_row(board, row);
+
   for (int j = 0; j < board->width; ++j) {
-    if (!board->is_filled[row][j]) return false;
+    if (!cells[j]) return false;
   }
   return true;
 }
 
 
 
-int remove_and_count_full_rows(struct GameBoard *board, int bottom_row, int top_row, WINDOW *win)
+void remove_row(struct GameBoard *board, int row)
+{
+  /*
+   * Either the rows above the deleted one drop, or the rows below it rise and the ring
+   * turns back by one, bringing the freed slot in on top: whichever moves fewer rows.
+   * Those above the stack are all empty and needn't move, so on a tall board a clear
+   * only ever costs the height of the stack.
+   */
+  if (row - board->stack_top <= board->height - 1 - row) {
+
+    for (int y = row; y > board->stack_top; --y) {
+      memcpy(board_row(board, y), board_row(board, y - 1), board->width);
+    }
+    memset(board_row(board, board->stack_top), 0, board->width);
+
+  } else {
+
+    for (int y = row; y < board->height - 1; ++y) {
+      memcpy(board_row(board, y), board_row(board, y + 1), board->width);
+    }
+    memset(board_row(board, board->height - 1), 0, board->width);
+
+    board->top = (board->top + board->height - 1) % board->height;
+  }
+
+  board->stack_top = Min(board->stack_top + 1, board->height);
+}
+
+
+
+bool add_garbage_rows(struct GameBoard *board, int num_rows, int hole)
+{
+  /* Rows pushed out at the top are lost: if any of them had blocks, that's a top out */
+  bool fits = board->stack_top >= num_rows;
+
+  /* Turning the ring forward raises every row, and brings the top slots in at the bottom */
+  for (int i = 0; i < num_rows; ++i) {
+    board->top = (board->top + 1) % board->height;
+
+    uint8_t *cells = board_row(board, board->height - 1);
+    memset(cells, DEAD_TYPE, board->width);
+    cells[hole] = 0;
+  }
+
+  board->stack_top = Max(board->stack_top - num_rows, 0);
+
+  return fits;
+}
+
+
+
+int remove_and_count_full_rows(struct GameBoard *board, int bottom_row, int top_row, int *cleared,
+			       WINDOW *win)
 {
+  TraceBegin("remove_and_count_full_rows");
+
   int deleted = 0;
   int row = bottom_row;
+  int rows[MAX_BLOCKS];		/* Deleted rows, in the coordinates before any deletion */
   
   for (int i = 0; i < bottom_row - top_row + 1; ++i) {
     
     if (row_is_full(board, row)) {
 
-      /* Delete the row in the board representation */
-      free(board->is_filled[row]);
-      /* 'Drop' all other rows (shift pointers down) */
-      memmove(board->is_filled + 1, board->is_filled, row * sizeof(*board->is_filled));
-      /* Replace the 'dropped' top row with a new empty one */
-      board->is_filled[0] = calloc(board->width, sizeof(board->is_filled[0][0]));
+      /* Delete the row in the board representation, and 'drop' all rows above it */
+      remove_row(board, row);
 
-      /* Visualize the effect on screen */
-      if (win) animate_drop(win, row);
+      /* The row was 'deleted' rows higher before the drops */
+      rows[deleted] = row - deleted;
       
       deleted += 1;
       
@@ -327,22 +729,85 @@ int remove_and_count_full_rows(struct GameBoard *board, int bottom_row, int top_
     }
   }
 
+  if (cleared != NULL) memcpy(cleared, rows, deleted * sizeof(rows[0]));
+
+  /* Visualize the effect on screen, all rows at once */
+  if (win != NULL && deleted > 0) animate_clear(win, rows, deleted);
+
+  TraceEnd("remove_and_count_full_rows");
+
   return deleted;
 }
 
 
 
-long score_from_lines(int num_lines)
+int game_lock_piece(struct Game *game, WINDOW *board_win, WINDOW *preview_win)
 {
-  
-  return 100 * ((1 << num_lines) / 2 + ((num_lines == 4) << 2));
+  /* Manage transformation of current piece into dead blocks, row deletion and score */
+  record_dead_blocks(&game->current, game->board);
+
+  int num_deleted = remove_and_count_full_rows(game->board, game->current.max_y,
+					       game->current.min_y, game->cleared, board_win);
+
+  game->score += score_from_lines(game->difficulty, num_deleted);
+  game->lines += num_deleted;
+  game->pieces += 1;
+
+  /* Move the tetromino from the preview window to the board */
+  game->current = game->preview;
+
+  reposition_tetromino(&game->current, SPAWN_HEIGHT, SPAWN_WIDTH, preview_win, board_win);
+
+  init_tetromino(&game->preview, random_type(&game->rng), PREVIEW_WIN_SIDE / 2 - 1,
+		 PREVIEW_WIN_SIDE / 2, preview_win);
+
+  /* GAMEOVER CONDITION: the piece already collides with a dead piece as soon as it spawns */
+  game->gameover = check_collision(&game->current, game->board) != NO_COLLISION;
+
+  return num_deleted;
+}
+
+
+
+long score_from_lines(const struct Difficulty *d, int num_lines)
+{
+  return d->line_scores[num_lines];
+}
+
+
+
+double speed_from_score(const struct Difficulty *d, long score)
+{
+  return d->initial_speed + (score / d->score_modulus) * d->speed_increment;
 }
 
 
+bool valid_rules(const struct Difficulty *d)
+{
+  /* What the rule flags accept: gravity must keep falling, and scores can't go down */
+  bool valid = isfinite(d->initial_speed) && d->initial_speed > 0.
+    && isfinite(d->speed_increment) && d->speed_increment >= 0.
+    && d->score_modulus > 0;
+
+  for (int k = 0; k <= MAX_BLOCKS && valid; ++k) valid = d->line_scores[k] >= 0;
+
+  return valid;
+}
+
 
-double speed_from_score(long score)
+bool ranked_rules(const struct Difficulty *d, int board_height)
 {
-  return INITIAL_SPEED + (score / SCORE_MODULUS) * SPEED_INCREMENT;
+  /* Other rules make other scores: they would crowd out (or never reach) the rankings */
+  bool same = board_height == BOARD_HEIGHT
+    && d->initial_speed == default_difficulty.initial_speed
+    && d->speed_increment == default_difficulty.speed_increment
+    && d->score_modulus == default_difficulty.score_modulus;
+
+  for (int k = 0; k <= MAX_BLOCKS && same; ++k) {
+    same = d->line_scores[k] == default_difficulty.line_scores[k];
+  }
+
+  return same;
 }
 
 
@@ -357,164 +822,4569 @@ double get_real_time(void)
 }
 
 
+double real_clock_now(struct Clock *clock)
+{
+  return get_real_time();
+}
 
 
-
-/* 
- * Graphics
- */
-
-
-void draw_tetromino(WINDOW *win, struct Tetromino * const t, int offset_y, int offset_x)
+void real_clock_skip_to(struct Clock *clock, double time)
 {
-  wcolor_set(win, t->type, NULL);
-  for (int i = 0; i < MAX_BLOCKS; ++i) { 
-    mvwaddch(win, offset_y + t->square[i].y, offset_x + t->square[i].x, ACS_DIAMOND);
-  }  
+  /* Real time can't be skipped: the caller keeps polling until it gets there */
 }
 
 
-void delete_tetromino(WINDOW *win, struct Tetromino * const t, int offset_y, int offset_x)
+double virtual_clock_now(struct Clock *clock)
 {
-  wcolor_set(win, 0, NULL);
-  for (int i = 0; i < MAX_BLOCKS; ++i) {
-    mvwaddch(win, offset_y + t->square[i].y, offset_x + t->square[i].x, ' ');
-  }
+  return clock->time;
 }
 
-void draw_board(WINDOW *win, int top_left_y, int top_left_x, int height, int width)
+
+void virtual_clock_skip_to(struct Clock *clock, double time)
 {
-  /* Basic line */
-  mvwvline(win, top_left_y, top_left_x - 1, ACS_VLINE, height);
-  mvwvline(win, top_left_y, top_left_x + width, ACS_VLINE, height);
-  mvwhline(win, top_left_y + height, top_left_x, ACS_HLINE, width);
-  mvwaddch(win, top_left_y + height, top_left_x - 1, ACS_LLCORNER);
-  mvwaddch(win, top_left_y + height, top_left_x + width, ACS_LRCORNER);
-  
-  /* Walls */
-  mvwvline(win, top_left_y, top_left_x - 2, ACS_CKBOARD, height + 1);
-  mvwvline(win, top_left_y, top_left_x + width + 1, ACS_CKBOARD, height + 1);
-  mvwhline(win, top_left_y + height + 1, top_left_x - 2, ACS_CKBOARD, width + 4);
+  clock->time = Max(clock->time, time);
 }
 
 
-void animate_drop(WINDOW *win, int row)
+double warped_clock_now(struct Clock *clock)
 {
-  wmove(win, row, 0);
-  wdeleteln(win);
-  wmove(win, 0, 0);
-  winsertln(win);
+  /* Real time, sped up: it can't skip either */
+  return clock->time + clock->rate * (get_real_time() - clock->time);
 }
 
 
-void draw_updated_stats(WINDOW *win, long score, double speed)
+bool apply_gravity(struct Game *game, double now, double speed, WINDOW *board_win)
 {
-  int height, width;
-  getmaxyx(win, height, width);
-  
-  char score_str[11];
-  snprintf(score_str, 11, "%010ld", score);
+  if (now < game->threshold) return false;
 
-  mvwaddstr(win, height / 3 - 1, (width - strlen(score_str)) / 2, "SCORE:");
-  mvwaddstr(win, height / 3, (width - strlen(score_str)) / 2, score_str);
-
-  char speed_str[11];
-  snprintf(speed_str, 11, "%.2gx", speed);
+  /*
+   * All the rows due by now fall in one step: at high speeds that is several per call
+   * (the whole way down at 20G), and a stalled game catches up at once.
+   */
+  double due = 1. + floor((now - game->threshold) * speed);
 
-  mvwaddstr(win, 2 * height / 3 - 1, (width - strlen(score_str)) / 2, "SPEED:");
-  mvwaddstr(win, 2 * height / 3, (width - strlen(score_str)) / 2, speed_str);
-  
-}
+  game->threshold += due / speed;
 
+  int distance = drop_distance(&game->current, game->board);
 
-WINDOW *draw_message_popup(int col_offt, char *msg)
-{
-  int screen_height, screen_width;
-  getmaxyx(stdscr, screen_height, screen_width);
-  
-  WINDOW *win = newwin(5, strlen(msg) + 4,
-		       (screen_height) / 2 - 2 + col_offt,
-		       (screen_width - strlen(msg)) / 2);
-  
-  box(win, ACS_VLINE, ACS_HLINE);
+  if (distance > 0) {
+    move_tetromino(&game->current, game->board, due < distance ? (int)due : distance, 0, board_win);
+  }
 
-  mvwaddnstr(win, 2, 2, msg, strlen(msg));
-  
-  return win;
+  /* A piece that can't fall as far as it should has landed, and must be locked */
+  return due > distance;
 }
 
 
-/* 
- * Game Phases
+
+
+/*
+ * Bots and Simulation
  */
 
 
-enum GameState title_screen(void)
+int enumerate_placements(struct Game *game, struct Candidate candidates[MAX_CANDIDATES])
 {
-  clear();
-    
-  int screen_height, screen_width;
-  getmaxyx(stdscr, screen_height, screen_width);
+  int n = 0;
 
-  for (int i = 0; i < TITLE_HEIGHT; ++i)
-    mvprintw(screen_height / 3 + i, (screen_width - TITLE_WIDTH) / 2, title_string[i]);
-  
-  char *welcome_string = "Press [RET] to play, [S] to display the rankings, or [Q] to quit.";
-  mvprintw(screen_height * 2 / 3, (screen_width - strlen(welcome_string)) / 2, welcome_string);
+  for (int r = 0; r < game->current.num_states; ++r) {
 
-  box(stdscr, ACS_VLINE, ACS_HLINE);
-    
-  wrefresh(stdscr);
+    struct Tetromino t = game->current;
+    bool reachable = true;
 
-  enum GameState next_state;
-  
-  while (true) {
-    chtype ch = getch();
-    if (ch == KEY_RETURN) {
-      next_state = STATE_GAME;
-      break;
-    } else if (toupper(ch) == 'S') {
-      next_state = STATE_SCORES;
+    for (int i = 0; i < r && reachable; ++i) {
+      reachable = rotate_tetromino(&t, game->board, NULL) == NO_COLLISION;
+    }
+
+    if (!reachable) continue;
+
+    /* Slide to the left wall (or stack), then sweep right one column at a time */
+    while (move_tetromino(&t, game->board, 0, -1, NULL) == NO_COLLISION);
+
+    do {
+      struct Candidate *c = &candidates[n++];
+
+      c->placement = (struct Placement){ .rotations = r, .x = t.center_x };
+      c->landed = t;
+
+      move_tetromino(&c->landed, game->board, drop_distance(&c->landed, game->board), 0, NULL);
+
+    } while (n < MAX_CANDIDATES && move_tetromino(&t, game->board, 0, +1, NULL) == NO_COLLISION);
+  }
+
+  return n;
+}
+
+
+void board_to_bits(struct GameBoard *board, uint16_t *rows)
+{
+  for (int y = 0; y < board->height; ++y) {
+    uint8_t *cells = board_row(board, y);
+    rows[y] = 0;
+    for (int x = 0; x < board->width; ++x) rows[y] |= (uint16_t)(cells[x] != 0) << x;
+  }
+}
+
+
+int lock_into_bits(const uint16_t *board_rows, int height, int width, struct Tetromino *landed,
+		   uint16_t *rows)
+{
+  uint16_t full = (1 << width) - 1;
+
+  memcpy(rows, board_rows, height * sizeof(rows[0]));
+
+  for (int i = 0; i < MAX_BLOCKS; ++i) rows[landed->square[i].y] |= 1 << landed->square[i].x;
+
+  /* Remove the full rows, compacting the rest downwards */
+  int lines = 0;
+
+  for (int y = height - 1; y >= 0; --y) {
+    if (rows[y] == full) {
+      lines += 1;
+    } else if (lines > 0) {
+      rows[y + lines] = rows[y];
+    }
+  }
+
+  for (int y = 0; y < lines; ++y) rows[y] = 0;
+
+  return lines;
+}
+
+
+BitRows popcount_lanes(BitRows v)
+{
+  v = v - ((v >> 1) & 0x5555);
+  v = (v & 0x3333) + ((v >> 2) & 0x3333);
+  v = (v + (v >> 4)) & 0x0F0F;
+  return (v + (v >> 8)) & 0x00FF;
+}
+
+
+void evaluate_feature_batch(const BitRows *rows, int height, int width,
+			    BitRows features[NUM_FEATURES])
+{
+  const uint16_t full = (1 << width) - 1;
+  const uint16_t right_wall = 1 << (width - 1);
+  const uint16_t walls = 1 | 1 << (width + 1); /* Both walls around a row shifted by one */
+  const uint16_t wall_pairs = (1 << (width + 1)) - 1;
+
+  /*
+   * A single top-down sweep. 'covered' marks the columns with a filled cell at or above
+   * the current row, so summing its popcounts gives the column heights, and comparing
+   * neighbouring bits of it gives the height differences row by row.
+   */
+  BitRows covered = { 0 };
+  BitRows previous = { 0 };
+
+  for (int k = 0; k < NUM_FEATURES; ++k) features[k] = (BitRows){ 0 };
+
+  for (int y = 0; y < height; ++y) {
+
+    BitRows r = rows[y];
+    covered |= r;
+
+    BitRows left = (r << 1) | 1;		   /* Left neighbour of every cell, wall included */
+    BitRows right = (r >> 1) | right_wall;	   /* Right neighbour, wall included */
+    BitRows walled = (r << 1) | walls;
+
+    features[FEAT_HEIGHT] += popcount_lanes(covered);
+    features[FEAT_BUMPINESS] += popcount_lanes((covered ^ (covered >> 1)) & (full >> 1));
+    features[FEAT_HOLES] += popcount_lanes(covered & ~r);
+    features[FEAT_WELLS] += popcount_lanes(~covered & left & right & full);
+    features[FEAT_ROW_TRANSITIONS] += popcount_lanes((walled ^ (walled >> 1)) & wall_pairs);
+    if (y > 0) features[FEAT_COL_TRANSITIONS] += popcount_lanes(r ^ previous);
+
+    previous = r;
+  }
+
+  features[FEAT_COL_TRANSITIONS] += popcount_lanes(~previous & full); /* Against the floor */
+}
+
+
+void evaluate_candidates(struct GameBoard *board, struct Candidate *candidates, int n,
+			 double features[][NUM_FEATURES])
+{
+  int height = board->height;
+
+  uint16_t board_rows[height];
+  board_to_bits(board, board_rows);
+
+  for (int first = 0; first < n; first += FEATURE_BATCH) {
+
+    int lanes = Min(n - first, FEATURE_BATCH);
+    int lines[FEATURE_BATCH];
+
+    /* Lay the candidates out lane by lane: batch[y] holds row y of every candidate */
+    BitRows batch[height];
+    memset(batch, 0, sizeof(batch));
+
+    for (int lane = 0; lane < lanes; ++lane) {
+      uint16_t rows[height];
+      lines[lane] = lock_into_bits(board_rows, height, board->width,
+				   &candidates[first + lane].landed, rows);
+      for (int y = 0; y < height; ++y) batch[y][lane] = rows[y];
+    }
+
+    BitRows batch_features[NUM_FEATURES];
+    evaluate_feature_batch(batch, height, board->width, batch_features);
+
+    for (int lane = 0; lane < lanes; ++lane) {
+
+      struct Tetromino *landed = &candidates[first + lane].landed;
+      double *f = features[first + lane];
+
+      for (int k = 0; k < NUM_FEATURES; ++k) f[k] = batch_features[k][lane];
+
+      f[FEAT_LINES] = lines[lane];
+      f[FEAT_LANDING] = height - (landed->min_y + landed->max_y) / 2.;
+    }
+  }
+}
+
+
+struct Placement heuristic_policy(struct Game *game, const double *weights, uint64_t *rng)
+{
+  struct Candidate candidates[MAX_CANDIDATES];
+  int n = enumerate_placements(game, candidates);
+
+  double features[MAX_CANDIDATES][NUM_FEATURES];
+  evaluate_candidates(game->board, candidates, n, features);
+
+  struct Placement best = { .rotations = 0, .x = game->current.center_x };
+  double best_value = -HUGE_VAL;
+
+  for (int i = 0; i < n; ++i) {
+
+    double value = 0.;
+    for (int k = 0; k < NUM_FEATURES; ++k) value += weights[k] * features[i][k];
+
+    if (value > best_value) {
+      best_value = value;
+      best = candidates[i].placement;
+    }
+  }
+
+  return best;
+}
+
+
+struct Placement random_policy(struct Game *game, const double *weights, uint64_t *rng)
+{
+  struct Candidate candidates[MAX_CANDIDATES];
+  int n = enumerate_placements(game, candidates);
+
+  if (n == 0) return (struct Placement){ .rotations = 0, .x = game->current.center_x };
+
+  return candidates[next_random(rng) % n].placement;
+}
+
+
+bool split_weights(char *spec, double weights[NUM_FEATURES])
+{
+  char *colon = strrchr(spec, ':');
+  if (colon == NULL) return false;
+
+  const char *text = colon + 1;
+  char *end;
+
+  for (int k = 0; k < NUM_FEATURES; ++k) {
+    weights[k] = strtod(text, &end);
+    if (end == text || *end != (k < NUM_FEATURES - 1 ? ',' : '\0')) return false;
+    text = end + 1;
+  }
+
+  *colon = '\0';
+  return true;
+}
+
+
+bool load_policy(const char *spec, struct Policy *policy)
+{
+  /* A trailing ":w1,w2,..." (one per feature) overrides the policy's weights */
+  char name[PATH_MAX];
+  double weights[NUM_FEATURES];
+
+  snprintf(name, sizeof(name), "%s", spec);
+  bool custom = split_weights(name, weights);
+
+  bool builtin = false;
+
+  for (int i = 0; i < NUM_BUILTIN_POLICIES && !builtin; ++i) {
+    if (strcmp(name, builtin_policies[i].name) == 0) {
+      *policy = builtin_policies[i];
+      builtin = true;
+    }
+  }
+
+  /* Anything else is a shared object exporting a PolicyFunc */
+  if (!builtin) {
+
+    void *handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+
+    if (handle == NULL) {
+      fprintf(stderr, "%s: not a built-in policy, and %s\n", name, dlerror());
+      return false;
+    }
+
+    PolicyFunc choose = (PolicyFunc)dlsym(handle, POLICY_SYMBOL);
+
+    if (choose == NULL) {
+      fprintf(stderr, "%s: %s\n", name, dlerror());
+      dlclose(handle);
+      return false;
+    }
+
+    /* Shared objects get the default weights, to use or ignore */
+    *policy = builtin_policies[0];
+    policy->choose = choose;
+
+    snprintf(policy->name, sizeof(policy->name), "%s", basename(name));
+  }				/* The handle stays open until exit */
+
+  if (custom) {			/* Marked, to tell it from the stock weights in a tournament */
+    memcpy(policy->weights, weights, sizeof(weights));
+    size_t len = strlen(policy->name);
+    if (len + 1 < sizeof(policy->name)) strcpy(policy->name + len, "*");
+  }
+
+  return true;
+}
+
+
+void apply_placement(struct Game *game, struct Placement placement)
+{
+  for (int i = 0; i < placement.rotations; ++i) {
+    rotate_tetromino(&game->current, game->board, NULL);
+  }
+
+  int dx = placement.x < game->current.center_x ? -1 : +1;
+
+  while (game->current.center_x != placement.x
+	 && move_tetromino(&game->current, game->board, 0, dx, NULL) == NO_COLLISION);
+
+  move_tetromino(&game->current, game->board, drop_distance(&game->current, game->board), 0, NULL);
+}
+
+
+struct GameResult simulate_game(const struct Policy *policy, uint64_t seed, long max_pieces,
+				struct TrajectoryWriter *trajectories)
+{
+  struct Game game;
+  game_init(&game, seed, NULL, NULL);
+
+  /* The bot draws from its own stream, so the piece sequence only depends on the seed */
+  uint64_t policy_rng = ~seed;
+
+  /* Transitions are kept until the end of the game, to take the writer's lock only once */
+  struct TransitionBuffer steps = { NULL, 0, 0 };
+  unsigned episode = trajectories ? new_episode(trajectories) : 0;
+
+  while (!game.gameover && game.pieces < max_pieces) {
+
+    apply_placement(&game, policy->choose(&game, policy->weights, &policy_rng));
+
+    if (trajectories == NULL) {
+      game_lock_piece(&game, NULL, NULL);
+      continue;
+    }
+
+    if (steps.len == steps.cap) {
+      steps.cap = Max(2 * steps.cap, 64);
+      steps.records = realloc(steps.records, steps.cap * sizeof(*steps.records));
+      Die(steps.records == NULL);
+    }
+
+    long score_before = game.score;
+    begin_transition(&game, episode, &steps.records[steps.len]);
+    game_lock_piece(&game, NULL, NULL);
+    end_transition(&game, score_before, &steps.records[steps.len++]);
+  }
+
+  if (trajectories != NULL) {
+    submit_transitions(trajectories, steps.records, steps.len);
+    free(steps.records);
+  }
+
+  free_gameboard(game.board);
+
+  return (struct GameResult){ .score = game.score, .lines = game.lines, .pieces = game.pieces };
+}
+
+
+uint64_t game_seed(uint64_t base_seed, int index)
+{
+  uint64_t state = base_seed + index;
+  return next_random(&state);
+}
+
+
+void run_workers(void *(*worker)(void *), void *arg)
+{
+  int num_threads = options.threads > 0 ? options.threads : sysconf(_SC_NPROCESSORS_ONLN);
+  num_threads = Max(num_threads, 1);
+
+  pthread_t threads[num_threads];
+
+  for (int i = 0; i < num_threads; ++i) {
+    errno = pthread_create(&threads[i], NULL, worker, arg);
+    Die(errno != 0);
+  }
+
+  for (int i = 0; i < num_threads; ++i) pthread_join(threads[i], NULL);
+}
+
+
+void *tournament_worker(void *arg)
+{
+  struct Tournament *t = arg;
+  int num_jobs = t->num_policies * t->num_games;
+
+  for (int job; (job = atomic_fetch_add(&t->next_job, 1)) < num_jobs; ) {
+    t->results[job] = simulate_game(&t->policies[job / t->num_games],
+				    game_seed(t->seed, job % t->num_games), t->max_pieces,
+				    t->trajectories);
+  }
+
+  return NULL;
+}
+
+
+int compare_scores(const void *a, const void *b)
+{
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+
+int tournament(int num_specs, char *specs[])
+{
+  struct Policy policies[MAX_POLICIES];
+  int num_policies = 0;
+
+  if (num_specs == 0) {		/* Default: every built-in bot */
+    for (int i = 0; i < NUM_BUILTIN_POLICIES; ++i) policies[num_policies++] = builtin_policies[i];
+  }
+
+  if (num_specs > MAX_POLICIES) {
+    fprintf(stderr, "--tournament: at most %d policies\n", MAX_POLICIES);
+    return EXIT_FAILURE;
+  }
+
+  for (int i = 0; i < num_specs; ++i) {
+    if (!load_policy(specs[i], &policies[num_policies++])) return EXIT_FAILURE;
+  }
+
+  struct Tournament t = {
+    .policies = policies,
+    .num_policies = num_policies,
+    .num_games = Max(options.games, 1),
+    .seed = options.seed,
+    .max_pieces = options.max_pieces,
+    .next_job = 0,
+    .trajectories = NULL
+  };
+
+  if (options.trajectory_path != NULL) {
+    t.trajectories = open_trajectory_writer(options.trajectory_path);
+  }
+
+  t.results = malloc(num_policies * t.num_games * sizeof(*t.results));
+  Die(t.results == NULL);
+
+  double start = get_real_time();
+  run_workers(&tournament_worker, &t);
+  close_trajectory_writer(t.trajectories);
+  double elapsed = get_real_time() - start;
+
+  /* Bot games join the history only when asked to, under the policy's name */
+  if (options.score_index_path != NULL
+      && !ranked_rules(&options.difficulty, options.board_height)) {
+    fprintf(stderr, "--score-index: games on other rules than the defaults are not indexed\n");
+  } else if (options.score_index_path != NULL) {
+
+    struct ScoreIndex *scores = open_score_index(options.score_index_path);
+
+    if (scores == NULL) {
+      free(t.results);
+      return EXIT_FAILURE;
+    }
+
+    for (int job = 0; job < num_policies * t.num_games; ++job) {
+      score_index_insert(scores, policies[job / t.num_games].name, t.results[job].score,
+			 time(NULL), NULL);
+    }
+
+    close_score_index(scores);
+  }
+
+  printf("%d policies x %d games (seed %llu, at most %ld pieces) in %.2fs\n\n",
+	 num_policies, t.num_games, (unsigned long long)t.seed, t.max_pieces, elapsed);
+
+  printf("%-20s %10s %10s %10s %10s %10s %10s %8s %8s %6s\n", "policy", "mean", "95% CI",
+	 "stddev", "median", "min", "max", "lines", "pieces", "speed");
+
+  long *scores = malloc(t.num_games * sizeof(*scores));
+  Die(scores == NULL);
+
+  for (int p = 0; p < num_policies; ++p) {
+
+    struct GameResult *r = &t.results[p * t.num_games];
+    double mean = 0., sq = 0., lines = 0., pieces = 0., speed = 0.;
+
+    for (int g = 0; g < t.num_games; ++g) {
+      scores[g] = r[g].score;
+      mean += r[g].score;
+      lines += r[g].lines;
+      pieces += r[g].pieces;
+      speed += speed_from_score(&options.difficulty, r[g].score);
+    }
+
+    mean /= t.num_games;
+    for (int g = 0; g < t.num_games; ++g) sq += (r[g].score - mean) * (r[g].score - mean);
+
+    double stddev = t.num_games > 1 ? sqrt(sq / (t.num_games - 1)) : 0.;
+
+    qsort(scores, t.num_games, sizeof(scores[0]), compare_scores);
+
+    printf("%-20s %10.1f %10.1f %10.1f %10ld %10ld %10ld %8.1f %8.1f %6.2f\n", policies[p].name,
+	   mean, 1.96 * stddev / sqrt(t.num_games), stddev, scores[t.num_games / 2], scores[0],
+	   scores[t.num_games - 1], lines / t.num_games, pieces / t.num_games,
+	   speed / t.num_games);
+  }
+
+  /* Games are paired by seed, so the per-seed difference is the low-noise comparison */
+  if (num_policies > 1) printf("\nhead-to-head on identical piece sequences:\n");
+
+  for (int a = 0; a < num_policies; ++a) {
+    for (int b = a + 1; b < num_policies; ++b) {
+
+      int wins = 0, draws = 0;
+      double mean = 0., sq = 0.;
+
+      for (int g = 0; g < t.num_games; ++g) {
+	long d = t.results[a * t.num_games + g].score - t.results[b * t.num_games + g].score;
+	wins += d > 0;
+	draws += d == 0;
+	mean += d;
+      }
+
+      mean /= t.num_games;
+
+      for (int g = 0; g < t.num_games; ++g) {
+	double d = t.results[a * t.num_games + g].score - t.results[b * t.num_games + g].score;
+	sq += (d - mean) * (d - mean);
+      }
+
+      double ci = t.num_games > 1 ? 1.96 * sqrt(sq / (t.num_games - 1) / t.num_games) : 0.;
+
+      printf("  %s vs %s: %d-%d-%d (W-D-L), mean difference %.1f +/- %.1f\n",
+	     policies[a].name, policies[b].name, wins, draws, t.num_games - wins - draws,
+	     mean, ci);
+    }
+  }
+
+  free(scores);
+  free(t.results);
+
+  return EXIT_SUCCESS;
+}
+
+
+
+struct TimedResult simulate_timed_game(const struct Policy *policy, uint64_t seed,
+				       const struct Difficulty *difficulty, struct Clock *clock)
+{
+  struct TimedResult result = { .levels = 1, .level_time = { 0. } };
+
+  struct Game game;
+  game_init(&game, seed, NULL, NULL);
+
+  /* In a sweep, every worker plays its own rules */
+  game.difficulty = difficulty;
+  game.threshold = 1. / difficulty->initial_speed;
+
+  double start = clock->now(clock);
+  game.threshold += start;
+
+  /*
+   * The bot decides instantly when a piece spawns, but then enters its moves one at a
+   * time at options.input_rate, while gravity keeps pulling: at high speeds it can run
+   * out of time, just like a human.
+   */
+  uint64_t policy_rng = ~seed;
+  struct Placement target = policy->choose(&game, policy->weights, &policy_rng);
+  int rotations_left = target.rotations;
+  double next_input = start + 1. / options.input_rate;
+
+  while (!game.gameover && game.pieces < options.max_pieces) {
+
+    double now = clock->now(clock);
+    double speed = speed_from_score(difficulty, game.score);
+    int level = game.score / difficulty->score_modulus;
+
+    for (; result.levels <= level && result.levels < MAX_LEVELS; ++result.levels) {
+      result.level_time[result.levels] = now - start;
+    }
+
+    if (apply_gravity(&game, now, speed, NULL)) {
+
+      game_lock_piece(&game, NULL, NULL);
+
+      if (!game.gameover) {
+	target = policy->choose(&game, policy->weights, &policy_rng);
+	rotations_left = target.rotations;
+	next_input = now + 1. / options.input_rate;
+      }
+
+      continue;
+    }
+
+    if (now >= next_input) {
+
+      if (rotations_left > 0) {
+	rotate_tetromino(&game.current, game.board, NULL);
+	rotations_left -= 1;
+      } else if (game.current.center_x != target.x) {
+	move_tetromino(&game.current, game.board, 0,
+		       target.x < game.current.center_x ? -1 : +1, NULL);
+      }
+
+      next_input += 1. / options.input_rate;
+      continue;
+    }
+
+    /* Nothing can happen before the next gravity step or input */
+    clock->skip_to(clock, Min(game.threshold, next_input));
+  }
+
+  result.survival = clock->now(clock) - start;
+  result.score = game.score;
+  result.pieces = game.pieces;
+
+  free_gameboard(game.board);
+
+  return result;
+}
+
+
+struct GravityTest {
+  const struct Policy *	policy;
+  int			num_games;
+  atomic_int		next_job;
+  struct TimedResult *	results;
+};
+
+
+void *gravity_test_worker(void *arg)
+{
+  struct GravityTest *t = arg;
+
+  for (int job; (job = atomic_fetch_add(&t->next_job, 1)) < t->num_games; ) {
+    struct Clock clock = { virtual_clock_now, virtual_clock_skip_to, 0., 1. };
+    t->results[job] = simulate_timed_game(t->policy, game_seed(options.seed, job),
+					  &options.difficulty, &clock);
+  }
+
+  return NULL;
+}
+
+
+int gravity_test(int num_specs, char *specs[])
+{
+  struct Policy policy = builtin_policies[0];
+
+  if (num_specs > 0 && !load_policy(specs[0], &policy)) return EXIT_FAILURE;
+
+  struct GravityTest t = {
+    .policy = &policy,
+    .num_games = Max(options.games, 1),
+    .next_job = 0
+  };
+
+  t.results = malloc(t.num_games * sizeof(*t.results));
+  Die(t.results == NULL);
+
+  double start = get_real_time();
+  run_workers(&gravity_test_worker, &t);
+  double elapsed = get_real_time() - start;
+
+  double survival = 0., sq = 0., score = 0.;
+
+  for (int g = 0; g < t.num_games; ++g) {
+    survival += t.results[g].survival;
+    score += t.results[g].score;
+  }
+
+  survival /= t.num_games;
+
+  for (int g = 0; g < t.num_games; ++g) {
+    sq += (t.results[g].survival - survival) * (t.results[g].survival - survival);
+  }
+
+  printf("%s, %d games at %.1f inputs/s (speed %.3g%+.3g every %d points): %.3fs wall time\n",
+	 policy.name, t.num_games, options.input_rate, options.difficulty.initial_speed,
+	 options.difficulty.speed_increment, (int)options.difficulty.score_modulus, elapsed);
+
+  printf("survival %.1fs +/- %.1f (game time), mean score %.1f\n\n", survival,
+	 t.num_games > 1 ? 1.96 * sqrt(sq / (t.num_games - 1) / t.num_games) : 0.,
+	 score / t.num_games);
+
+  printf("%6s %8s %8s %12s\n", "level", "speed", "games", "reached at");
+
+  for (int level = 0; level < MAX_LEVELS; ++level) {
+
+    int reached = 0;
+    double when = 0.;
+
+    for (int g = 0; g < t.num_games; ++g) {
+      if (t.results[g].levels > level) {
+	reached += 1;
+	when += t.results[g].level_time[level];
+      }
+    }
+
+    if (reached == 0) break;
+
+    printf("%6d %8.2f %8d %11.1fs\n", level,
+	   speed_from_score(&options.difficulty, level * options.difficulty.score_modulus),
+	   reached, when / reached);
+  }
+
+  free(t.results);
+
+  return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * Weight Tuning
+ */
+
+
+double random_gaussian(uint64_t *state)
+{
+  /* Box-Muller, from two uniforms in (0, 1] */
+  double u = ((next_random(state) >> 11) + 1) * 0x1p-53;
+  double v = ((next_random(state) >> 11) + 1) * 0x1p-53;
+
+  return sqrt(-2. * log(u)) * cos(2. * M_PI * v);
+}
+
+
+int compare_fitness(const void *a, const void *b)
+{
+  double x = ((const struct TuneEntry *)a)->fitness, y = ((const struct TuneEntry *)b)->fitness;
+  return (x < y) - (x > y);	/* Best first */
+}
+
+
+int tune(int num_specs, char *specs[])
+{
+  struct Policy base = builtin_policies[0];
+  if (num_specs > 0 && !load_policy(specs[0], &base)) return EXIT_FAILURE;
+
+  int population = Max(options.population, 2);
+  int num_elite = Max(population / TUNE_ELITE_DIVISOR, 1);
+
+  struct Policy *candidates = malloc(population * sizeof(*candidates));
+  struct TuneEntry *ranked = malloc(population * sizeof(*ranked));
+  Die(candidates == NULL || ranked == NULL);
+
+  /* Cross-entropy method: a Gaussian per weight, refitted to the best candidates */
+  double mean[NUM_FEATURES], sigma[NUM_FEATURES];
+
+  for (int k = 0; k < NUM_FEATURES; ++k) {
+    mean[k] = base.weights[k];
+    sigma[k] = Max(fabs(mean[k]) / 2., TUNE_INITIAL_SIGMA);
+  }
+
+  uint64_t rng = ~options.seed;	/* Sampling draws from its own stream, apart from the games */
+
+  struct Tournament t = {
+    .policies = candidates,
+    .num_policies = population,
+    .num_games = Max(options.games, 1),
+    .max_pieces = options.max_pieces,
+    .trajectories = NULL
+  };
+
+  t.results = malloc(population * t.num_games * sizeof(*t.results));
+  Die(t.results == NULL);
+
+  printf("tuning %s: %d generations of %d candidates (%d elite), %d games each,"
+	 " at most %ld pieces\n\n", base.name, options.generations, population, num_elite,
+	 t.num_games, t.max_pieces);
+
+  printf("%4s %12s %12s %12s %10s %8s\n", "gen", "mean policy", "best", "elite", "sigma", "time");
+
+  for (int gen = 0; gen < options.generations; ++gen) {
+
+    /* Candidate 0 is the current mean itself, the others are sampled around it */
+    for (int c = 0; c < population; ++c) {
+      candidates[c] = base;
+      for (int k = 0; k < NUM_FEATURES; ++k) {
+	candidates[c].weights[k] = mean[k] + (c > 0 ? sigma[k] * random_gaussian(&rng) : 0.);
+      }
+    }
+
+    /* Common random numbers: in a generation, every candidate plays the same pieces */
+    t.seed = game_seed(options.seed, gen);
+    atomic_store(&t.next_job, 0);
+
+    double start = get_real_time();
+    run_workers(&tournament_worker, &t);
+    double elapsed = get_real_time() - start;
+
+    for (int c = 0; c < population; ++c) {
+      double score = 0.;
+      for (int g = 0; g < t.num_games; ++g) score += t.results[c * t.num_games + g].score;
+
+      ranked[c] = (struct TuneEntry){ .fitness = score / t.num_games, .index = c };
+    }
+
+    double mean_fitness = ranked[0].fitness;
+
+    qsort(ranked, population, sizeof(*ranked), compare_fitness);
+
+    double elite_fitness = 0., spread = 0.;
+
+    for (int k = 0; k < NUM_FEATURES; ++k) {
+
+      double m = 0., sq = 0.;
+
+      for (int e = 0; e < num_elite; ++e) m += candidates[ranked[e].index].weights[k];
+      m /= num_elite;
+
+      for (int e = 0; e < num_elite; ++e) {
+	double d = candidates[ranked[e].index].weights[k] - m;
+	sq += d * d;
+      }
+
+      mean[k] = m;
+      sigma[k] = Max(sqrt(sq / num_elite), TUNE_MIN_SIGMA); /* Some exploration is kept */
+      spread += sigma[k] / NUM_FEATURES;
+    }
+
+    for (int e = 0; e < num_elite; ++e) elite_fitness += ranked[e].fitness / num_elite;
+
+    printf("%4d %12.1f %12.1f %12.1f %10.3f %7.1fs\n", gen, mean_fitness, ranked[0].fitness,
+	   elite_fitness, spread, elapsed);
+    fflush(stdout);
+  }
+
+  /* Ready to be passed back as a policy, to a tournament say */
+  char spec[PATH_MAX];
+  double unused[NUM_FEATURES];
+
+  snprintf(spec, sizeof(spec), "%s", num_specs > 0 ? specs[0] : base.name);
+  split_weights(spec, unused);
+
+  printf("\n%s:", spec);
+  for (int k = 0; k < NUM_FEATURES; ++k) printf("%.4g%c", mean[k], k < NUM_FEATURES - 1 ? ',' : '\n');
+
+  free(t.results);
+  free(ranked);
+  free(candidates);
+
+  return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * Difficulty Sweeps
+ */
+
+
+bool set_difficulty_param(struct Difficulty *d, enum DifficultyParam param, const char *text)
+{
+  char *end;
+
+  switch (param) {
+
+  case PARAM_INITIAL_SPEED:
+    d->initial_speed = strtod(text, &end);
+    return end != text && *end == '\0' && isfinite(d->initial_speed) && d->initial_speed > 0.;
+
+  case PARAM_SPEED_INCREMENT:
+    d->speed_increment = strtod(text, &end);
+    return end != text && *end == '\0' && isfinite(d->speed_increment)
+      && d->speed_increment >= 0.;
+
+  case PARAM_SCORE_MODULUS:
+    d->score_modulus = strtol(text, &end, 10);
+    return end != text && *end == '\0' && d->score_modulus > 0;
+
+  case PARAM_LINE_SCORES:	/* Points for 1 to MAX_BLOCKS lines, slash-separated */
+    for (int k = 1; k <= MAX_BLOCKS; ++k) {
+      d->line_scores[k] = strtol(text, &end, 10);
+      if (end == text || d->line_scores[k] < 0 || *end != (k < MAX_BLOCKS ? '/' : '\0')) {
+	return false;
+      }
+      text = end + 1;
+    }
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+
+void *sweep_worker(void *arg)
+{
+  struct Sweep *sw = arg;
+  int num_jobs = sw->num_settings * sw->num_games;
+
+  for (int job; (job = atomic_fetch_add(&sw->next_job, 1)) < num_jobs; ) {
+
+    int setting = job / sw->num_games, game = job % sw->num_games;
+    struct Clock clock = { virtual_clock_now, virtual_clock_skip_to, 0., 1. };
+
+    /* Common random numbers: a game has the same pieces under every setting */
+    sw->results[job] = simulate_timed_game(sw->policy, game_seed(options.seed, game),
+					   &sw->settings[setting], &clock);
+  }
+
+  return NULL;
+}
+
+
+int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+
+int difficulty_sweep(int num_specs, char *specs[])
+{
+  struct Policy policy = builtin_policies[0];
+  if (num_specs > 0 && !load_policy(specs[0], &policy)) return EXIT_FAILURE;
+
+  /* Each parameter is a list of values (or its default), swept in every combination */
+  char *values[NUM_DIFFICULTY_PARAMS][MAX_SWEEP_VALUES];
+  int num_values[NUM_DIFFICULTY_PARAMS];
+  int num_settings = 1;
+
+  for (int p = 0; p < NUM_DIFFICULTY_PARAMS; ++p) {
+
+    num_values[p] = 0;
+
+    if (options.difficulty_lists[p] == NULL) {
+      values[p][num_values[p]++] = NULL;
+    } else {
+      char *save;
+      for (char *item = strtok_r(options.difficulty_lists[p], ",", &save);
+	   item != NULL && num_values[p] < MAX_SWEEP_VALUES; item = strtok_r(NULL, ",", &save)) {
+	values[p][num_values[p]++] = item;
+      }
+    }
+
+    if (num_values[p] == 0 || num_settings * num_values[p] > MAX_SWEEP_SETTINGS) {
+      fprintf(stderr, "%s: between 1 and %d values, and at most %d settings in all\n",
+	      difficulty_param_names[p], MAX_SWEEP_VALUES, MAX_SWEEP_SETTINGS);
+      return EXIT_FAILURE;
+    }
+
+    num_settings *= num_values[p];
+  }
+
+  struct Difficulty *settings = malloc(num_settings * sizeof(*settings));
+  Die(settings == NULL);
+
+  for (int s = 0; s < num_settings; ++s) {
+
+    settings[s] = options.difficulty;
+
+    /* Setting s in mixed radix, the last parameter changing fastest */
+    for (int p = NUM_DIFFICULTY_PARAMS - 1, rest = s; p >= 0; rest /= num_values[p--]) {
+
+      char *item = values[p][rest % num_values[p]];
+
+      if (item != NULL && !set_difficulty_param(&settings[s], p, item)) {
+	fprintf(stderr, "%s: not a valid value for %s\n", item, difficulty_param_names[p]);
+	free(settings);
+	return EXIT_FAILURE;
+      }
+    }
+  }
+
+  struct Sweep sw = {
+    .policy = &policy,
+    .settings = settings,
+    .num_settings = num_settings,
+    .num_games = Max(options.games, 1),
+    .next_job = 0
+  };
+
+  sw.results = malloc(num_settings * sw.num_games * sizeof(*sw.results));
+  double *survivals = malloc(sw.num_games * sizeof(*survivals));
+  long *scores = malloc(sw.num_games * sizeof(*scores));
+  Die(sw.results == NULL || survivals == NULL || scores == NULL);
+
+  double start = get_real_time();
+  run_workers(&sweep_worker, &sw);
+  double elapsed = get_real_time() - start;
+
+  printf("%s, %d settings x %d games at %.1f inputs/s, at most %ld pieces: %.3fs wall time\n\n",
+	 policy.name, num_settings, sw.num_games, options.input_rate, options.max_pieces, elapsed);
+
+  printf("%7s %7s %7s  %-18s %9s %7s %8s %8s %8s %10s %9s %9s %9s\n", "speed", "+speed",
+	 "every", "line scores", "survival", "+/-", "p10", "p50", "p90", "score", "p10", "p50",
+	 "p90");
+
+  for (int s = 0; s < num_settings; ++s) {
+
+    struct TimedResult *r = &sw.results[s * sw.num_games];
+    double survival = 0., sq = 0., score = 0.;
+
+    for (int g = 0; g < sw.num_games; ++g) {
+      survivals[g] = r[g].survival;
+      scores[g] = r[g].score;
+      survival += r[g].survival;
+      score += r[g].score;
+    }
+
+    survival /= sw.num_games;
+    for (int g = 0; g < sw.num_games; ++g) {
+      sq += (survivals[g] - survival) * (survivals[g] - survival);
+    }
+
+    qsort(survivals, sw.num_games, sizeof(survivals[0]), compare_doubles);
+    qsort(scores, sw.num_games, sizeof(scores[0]), compare_scores);
+
+    char line_scores[64];
+    snprintf(line_scores, sizeof(line_scores), "%ld/%ld/%ld/%ld", settings[s].line_scores[1],
+	     settings[s].line_scores[2], settings[s].line_scores[3], settings[s].line_scores[4]);
+
+    int n = sw.num_games;
+
+    printf("%7.3g %7.3g %7ld  %-18s %8.1fs %7.1f %7.1fs %7.1fs %7.1fs %10.1f %9ld %9ld %9ld\n",
+	   settings[s].initial_speed, settings[s].speed_increment, settings[s].score_modulus,
+	   line_scores, survival, n > 1 ? 1.96 * sqrt(sq / (n - 1) / n) : 0., survivals[n / 10],
+	   survivals[n / 2], survivals[n * 9 / 10], score / n, scores[n / 10], scores[n / 2],
+	   scores[n * 9 / 10]);
+  }
+
+  free(scores);
+  free(survivals);
+  free(sw.results);
+  free(settings);
+
+  return EXIT_SUCCESS;
+}
+
+
+/*
+ * Perfect Clears
+ */
+
+
+bool pc_board_bits(struct GameBoard *board, uint64_t *bits)
+{
+  *bits = 0;
+
+  /* Only rows from the top of the stack down can have blocks */
+  for (int y = board->stack_top; y < board->height; ++y) {
+
+    uint8_t *cells = board_row(board, y);
+    int row = board->height - 1 - y;
+
+    for (int x = 0; x < board->width; ++x) {
+      if (!cells[x]) continue;
+      if (row >= PC_HEIGHT) return false;
+      *bits |= (uint64_t)1 << (row * board->width + x);
+    }
+  }
+
+  return true;
+}
+
+
+uint64_t pc_state_key(uint64_t board, const int *queue, int len)
+{
+  uint64_t key = board << PC_BOARD_SHIFT | (uint64_t)len << PC_LEN_SHIFT;
+
+  for (int i = 0; i < len; ++i) {
+    key |= (uint64_t)queue[i] << (PC_LEN_SHIFT - PC_PIECE_BITS * (i + 1));
+  }
+
+  return key;
+}
+
+
+int pc_memo_find(struct PcMemo *memo, uint64_t key)
+{
+  if (memo->cap == 0) return -1;
+
+  uint64_t h = key;
+
+  for (size_t i = next_random(&h) & (memo->cap - 1); memo->slots[i] != 0;
+       i = (i + 1) & (memo->cap - 1)) {
+    if ((memo->slots[i] & ~(uint64_t)3) == key) return (memo->slots[i] >> 1) & 1;
+  }
+
+  return -1;
+}
+
+
+void pc_memo_insert(struct PcMemo *memo, uint64_t key, bool solvable)
+{
+  if (2 * (memo->len + 1) > memo->cap) {
+
+    struct PcMemo grown = { .cap = Max(2 * memo->cap, PC_MEMO_INITIAL), .len = 0 };
+    grown.slots = calloc(grown.cap, sizeof(*grown.slots));
+    Die(grown.slots == NULL);
+
+    for (size_t i = 0; i < memo->cap; ++i) {
+      uint64_t slot = memo->slots[i];
+      if (slot != 0) pc_memo_insert(&grown, slot & ~(uint64_t)3, (slot >> 1) & 1);
+    }
+
+    free(memo->slots);
+    *memo = grown;
+  }
+
+  uint64_t h = key;
+  size_t i = next_random(&h) & (memo->cap - 1);
+
+  while (memo->slots[i] != 0) i = (i + 1) & (memo->cap - 1);
+
+  memo->slots[i] = key | 1 | (uint64_t)solvable << 1;
+  memo->len += 1;
+}
+
+
+void pc_push_record(struct PcRecords *r, uint64_t record)
+{
+  if (r->len == r->cap) {
+    r->cap = Max(2 * r->cap, PC_MEMO_INITIAL);
+    r->records = realloc(r->records, r->cap * sizeof(*r->records));
+    Die(r->records == NULL);
+  }
+
+  r->records[r->len++] = record;
+}
+
+
+bool pc_search(struct GameBoard **boards, const int *queue, int len, struct PcMemo *memo,
+	       struct PcRecords *found)
+{
+  uint64_t bits;
+  pc_board_bits(boards[0], &bits);
+
+  uint64_t key = pc_state_key(bits, queue, len);
+  int known = pc_memo_find(memo, key);
+
+  if (known >= 0) return known;
+
+  /*
+   * Placements are enumerated from the spawn, as for the bots. The default rules, whatever
+   * the flags say: the database only depends on line clears.
+   */
+  struct Game game = { .board = boards[0], .difficulty = &default_difficulty, .gameover = false };
+
+  init_tetromino(&game.current, queue[0], SPAWN_HEIGHT, SPAWN_WIDTH, NULL);
+  init_tetromino(&game.preview, queue[len > 1 ? 1 : 0], PREVIEW_WIN_SIDE / 2 - 1,
+		 PREVIEW_WIN_SIDE / 2, NULL);
+
+  struct Candidate candidates[MAX_CANDIDATES];
+  int n = enumerate_placements(&game, candidates);
+
+  bool solvable = false;
+
+  for (int i = 0; i < n; ++i) {
+
+    /* Each placement is locked on the next level's board, a copy of this one */
+    copy_gameboard(boards[1], boards[0]);
+
+    game.board = boards[1];
+    game.current = candidates[i].landed;
+    game_lock_piece(&game, NULL, NULL);
+    game.board = boards[0];
+
+    uint64_t after;
+    if (!pc_board_bits(boards[1], &after)) continue; /* Sticks out of the setup */
+
+    /* The board has to clear with the last piece, not before */
+    bool works = after == 0 ? len == 1
+      : len > 1 && pc_search(boards + 1, queue + 1, len - 1, memo, found);
+
+    if (works) {
+      pc_push_record(found, key | (uint64_t)candidates[i].placement.rotations << 4
+		     | candidates[i].placement.x);
+      solvable = true;
+    }
+  }
+
+  pc_memo_insert(memo, key, solvable);
+
+  return solvable;
+}
+
+
+void *pc_generator_worker(void *arg)
+{
+  struct PcGenerator *gen = arg;
+
+  struct PcMemo memo = { .slots = NULL, .cap = 0, .len = 0 };
+  struct PcRecords found = { .records = NULL, .len = 0, .cap = 0 };
+
+  /* One board per level of the search: the first one stays empty */
+  struct GameBoard *boards[PC_MAX_PIECES + 1];
+  for (int i = 0; i <= PC_MAX_PIECES; ++i) boards[i] = new_gameboard(BOARD_HEIGHT, BOARD_WIDTH);
+
+  int num_tails = 1;
+  for (int i = PC_JOB_PIECES; i < PC_MAX_PIECES; ++i) num_tails *= MAX_TYPES;
+
+  int job;
+
+  while ((job = atomic_fetch_add(&gen->next_job, 1)) < gen->num_jobs) {
+
+    for (int tail = 0; tail < num_tails; ++tail) {
+
+      /* The queue's number in base MAX_TYPES, the job being its leading digits */
+      long code = (long)job * num_tails + tail;
+      int queue[PC_MAX_PIECES];
+
+      for (int i = PC_MAX_PIECES - 1; i >= 0; --i) {
+	queue[i] = 1 + code % MAX_TYPES;
+	code /= MAX_TYPES;
+      }
+
+      pc_search(boards, queue, PC_MAX_PIECES, &memo, &found);
+    }
+  }
+
+  pthread_mutex_lock(&gen->lock);
+
+  for (size_t i = 0; i < found.len; ++i) pc_push_record(&gen->found, found.records[i]);
+  gen->states += memo.len;
+
+  pthread_mutex_unlock(&gen->lock);
+
+  for (int i = 0; i <= PC_MAX_PIECES; ++i) free_gameboard(boards[i]);
+  free(found.records);
+  free(memo.slots);
+
+  return NULL;
+}
+
+
+int compare_records(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+
+int pc_generate(void)
+{
+  struct PcGenerator gen = {
+    .num_jobs = 1,
+    .found = { .records = NULL, .len = 0, .cap = 0 },
+    .states = 0
+  };
+
+  for (int i = 0; i < PC_JOB_PIECES; ++i) gen.num_jobs *= MAX_TYPES;
+
+  atomic_init(&gen.next_job, 0);
+  pthread_mutex_init(&gen.lock, NULL);
+
+  double start = get_real_time();
+  run_workers(&pc_generator_worker, &gen);
+
+  /* Workers search some states twice over, each on its own */
+  qsort(gen.found.records, gen.found.len, sizeof(uint64_t), compare_records);
+
+  size_t count = 0;
+
+  for (size_t i = 0; i < gen.found.len; ++i) {
+    if (count == 0 || gen.found.records[i] != gen.found.records[count - 1]) {
+      gen.found.records[count++] = gen.found.records[i];
+    }
+  }
+
+  struct PcDatabaseHeader header = {
+    .magic = PC_MAGIC,
+    .version = PC_VERSION,
+    .height = PC_HEIGHT,
+    .count = count
+  };
+
+  /* Written aside and renamed into place, so a running game never maps half a file */
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", options.pc_db_path);
+
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0;
+
+  if (ok) {
+    ok = write(fd, &header, sizeof(header)) == sizeof(header);
+    ok = ok && write(fd, gen.found.records, count * sizeof(uint64_t))
+      == (ssize_t)(count * sizeof(uint64_t));
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp_path, options.pc_db_path) == 0;
+    if (!ok) unlink(tmp_path);
+  }
+
+  if (!ok) {
+    perror(options.pc_db_path);
+    free(gen.found.records);
+    return EXIT_FAILURE;
+  }
+
+  /* Full queues from the empty board: the board bits of their records are all zero */
+  long num_queues = gen.num_jobs, num_solvable = 0;
+  for (int i = PC_JOB_PIECES; i < PC_MAX_PIECES; ++i) num_queues *= MAX_TYPES;
+
+  for (size_t i = 0; i < count && gen.found.records[i] >> PC_BOARD_SHIFT == 0; ++i) {
+    uint64_t prefix = gen.found.records[i] >> 6;
+    if (gen.found.records[i] >> PC_LEN_SHIFT == PC_MAX_PIECES
+	&& (i == 0 || gen.found.records[i - 1] >> 6 != prefix)) num_solvable++;
+  }
+
+  printf("%ld states searched, %zu records (%.1f MiB) written to %s in %.1fs\n", gen.states,
+	 count, (sizeof(header) + count * sizeof(uint64_t)) / 1048576., options.pc_db_path,
+	 get_real_time() - start);
+
+  printf("%ld of %ld queues of %d pieces perfect-clear the empty board (%.1f%%)\n",
+	 num_solvable, num_queues, PC_MAX_PIECES, 100. * num_solvable / num_queues);
+
+  free(gen.found.records);
+
+  return EXIT_SUCCESS;
+}
+
+
+struct PcDatabase *open_pc_database(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+  struct PcDatabaseHeader header;
+
+  if (fstat(fd, &st) < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+      || memcmp(header.magic, PC_MAGIC, sizeof(header.magic)) != 0
+      || header.version != PC_VERSION || header.height != PC_HEIGHT
+      || (size_t)st.st_size != sizeof(header) + header.count * sizeof(uint64_t)) {
+    close(fd);
+    return NULL;
+  }
+
+  struct PcDatabase *db = malloc(sizeof(*db));
+  Die(db == NULL);
+
+  /* Read-only and shared: every game and bot thread on the machine uses the same pages */
+  db->size = st.st_size;
+  db->header = mmap(NULL, db->size, PROT_READ, MAP_SHARED, fd, 0);
+  Die(db->header == MAP_FAILED);
+  db->records = (const uint64_t *)(db->header + 1);
+
+  close(fd);
+
+  return db;
+}
+
+
+void close_pc_database(struct PcDatabase *db)
+{
+  if (db == NULL) return;
+
+  munmap(db->header, db->size);
+  free(db);
+}
+
+
+void load_pc_database(void)
+{
+  pc_db = open_pc_database(options.pc_db_path);
+}
+
+
+struct PcDatabase *pc_database(void)
+{
+  /* Opened by whichever thread asks first: bots can be on many at once */
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, load_pc_database);
+
+  return pc_db;
+}
+
+
+size_t pc_lower_bound(const struct PcDatabase *db, uint64_t key)
+{
+  size_t lo = 0, hi = db->header->count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (db->records[mid] < key) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo;
+}
+
+
+double pc_lookup(const struct PcDatabase *db, struct Game *game, struct Placement *placement)
+{
+  uint64_t bits;
+  if (db == NULL || !pc_board_bits(game->board, &bits)) return 0.;
+
+  int known[PC_KNOWN_PIECES] = { game->current.type, game->preview.type };
+  double best = 0.;
+
+  /*
+   * Only the first pieces of the queue are known. For each length, the records of
+   * those pieces, whatever comes next, are a range: a placement's chance is the share
+   * of the unknown rest of the queue it works for, all of them equally likely.
+   */
+  for (int len = 1; len <= PC_MAX_PIECES; ++len) {
+
+    int k = Min(len, PC_KNOWN_PIECES);
+    uint64_t key = pc_state_key(bits, known, k) & ~((uint64_t)0xF << PC_LEN_SHIFT);
+    key |= (uint64_t)len << PC_LEN_SHIFT;
+
+    uint64_t end = key + ((uint64_t)1 << (PC_LEN_SHIFT - PC_PIECE_BITS * k));
+    size_t lo = pc_lower_bound(db, key), hi = pc_lower_bound(db, end);
+
+    double num_rests = 1.;
+    for (int i = k; i < len; ++i) num_rests *= MAX_TYPES;
+
+    /* Records are sorted by the rest of the queue first, so count per placement bits */
+    int counts[1 << 6] = { 0 };
+
+    for (size_t i = lo; i < hi; ++i) {
+      int bits = db->records[i] & 0x3F;
+      double chance = ++counts[bits] / num_rests;
+
+      if (chance > best) {
+	best = chance;
+	*placement = (struct Placement){ .rotations = bits >> 4, .x = bits & 0xF };
+      }
+    }
+  }
+
+  return best;
+}
+
+
+struct Placement pc_policy(struct Game *game, const double *weights, uint64_t *rng)
+{
+  struct Placement placement;
+
+  if (pc_lookup(pc_database(), game, &placement) > 0.) return placement;
+
+  return heuristic_policy(game, weights, rng);
+}
+
+
+/*
+ * Trajectory Dumps
+ */
+
+
+void write_trajectory_chunk(int fd, struct TransitionBuffer *chunk)
+{
+  int n = chunk->len;
+
+  struct TrajectoryChunkHeader header = {
+    .magic = TRAJECTORY_MAGIC,
+    .chunk_len = sizeof(header),
+    .num_records = n,
+    .board_height = BOARD_HEIGHT,
+    .board_width = BOARD_WIDTH
+  };
+
+  unsigned char *column = malloc(n * column_width[COL_BOARD]);
+  unsigned char *packed[NUM_TRAJECTORY_COLUMNS];
+  Die(column == NULL);
+
+  /* Columnar layout: gather one field of every record, then compress it on its own */
+  for (int c = 0; c < NUM_TRAJECTORY_COLUMNS; ++c) {
+
+    size_t width = column_width[c];
+
+    for (int i = 0; i < n; ++i) {
+      memcpy(column + i * width, (char *)&chunk->records[i] + column_offset[c], width);
+    }
+
+    uLongf len = compressBound(n * width);
+    packed[c] = malloc(len);
+    Die(packed[c] == NULL);
+    Die(compress2(packed[c], &len, column, n * width, Z_BEST_SPEED) != Z_OK);
+
+    header.column_len[c] = len;
+    header.chunk_len += len;
+  }
+
+  write_all(fd, &header, sizeof(header));
+
+  for (int c = 0; c < NUM_TRAJECTORY_COLUMNS; ++c) {
+    write_all(fd, packed[c], header.column_len[c]);
+    free(packed[c]);
+  }
+
+  free(column);
+}
+
+
+void *trajectory_io_thread(void *arg)
+{
+  struct TrajectoryWriter *w = arg;
+
+  pthread_mutex_lock(&w->lock);
+
+  while (true) {
+
+    /* Swap out a full buffer, or whatever is left once the writer is closing */
+    if (w->pending == NULL && w->filling->len > 0
+	&& (w->filling->len >= TRAJECTORY_CHUNK_LEN || w->closing)) {
+      w->pending = w->filling;
+      w->filling = w->filling == &w->buffer[0] ? &w->buffer[1] : &w->buffer[0];
+    }
+
+    if (w->pending == NULL) {
+      if (w->closing) break;
+      pthread_cond_wait(&w->wakeup, &w->lock);
+      continue;
+    }
+
+    /* Compression and write() happen with the lock released */
+    pthread_mutex_unlock(&w->lock);
+    write_trajectory_chunk(w->fd, w->pending);
+    pthread_mutex_lock(&w->lock);
+
+    w->pending->len = 0;
+    w->pending = NULL;
+  }
+
+  pthread_mutex_unlock(&w->lock);
+
+  return NULL;
+}
+
+
+struct TrajectoryWriter *open_trajectory_writer(const char *path)
+{
+  struct TrajectoryWriter *w = calloc(1, sizeof(*w));
+  Die(w == NULL);
+
+  w->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  Die(w->fd < 0);
+
+  for (int i = 0; i < 2; ++i) {
+    w->buffer[i].cap = TRAJECTORY_CHUNK_LEN;
+    w->buffer[i].records = malloc(TRAJECTORY_CHUNK_LEN * sizeof(*w->buffer[i].records));
+    Die(w->buffer[i].records == NULL);
+  }
+
+  w->filling = &w->buffer[0];
+  w->pending = NULL;
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->wakeup, NULL);
+
+  errno = pthread_create(&w->thread, NULL, &trajectory_io_thread, w);
+  Die(errno != 0);
+
+  return w;
+}
+
+
+void close_trajectory_writer(struct TrajectoryWriter *w)
+{
+  if (w == NULL) return;
+
+  pthread_mutex_lock(&w->lock);
+  w->closing = true;
+  pthread_cond_signal(&w->wakeup);
+  pthread_mutex_unlock(&w->lock);
+
+  pthread_join(w->thread, NULL);
+
+  pthread_cond_destroy(&w->wakeup);
+  pthread_mutex_destroy(&w->lock);
+  free(w->buffer[0].records);
+  free(w->buffer[1].records);
+  close(w->fd);
+  free(w);
+}
+
+
+void submit_transitions(struct TrajectoryWriter *w, const struct Transition *t, int n)
+{
+  if (w == NULL || n == 0) return;
+
+  pthread_mutex_lock(&w->lock);
+
+  struct TransitionBuffer *b = w->filling;
+
+  if (b->len + n > b->cap) {
+    b->cap = Max(2 * b->cap, b->len + n);
+    b->records = realloc(b->records, b->cap * sizeof(*b->records));
+    Die(b->records == NULL);
+  }
+
+  memcpy(b->records + b->len, t, n * sizeof(*t));
+  b->len += n;
+
+  if (b->len >= TRAJECTORY_CHUNK_LEN) pthread_cond_signal(&w->wakeup);
+
+  pthread_mutex_unlock(&w->lock);
+}
+
+
+unsigned new_episode(struct TrajectoryWriter *w)
+{
+  return atomic_fetch_add(&w->next_episode, 1);
+}
+
+
+void begin_transition(struct Game *game, unsigned episode, struct Transition *t)
+{
+  /* Call with the current piece at its final position, just before locking it */
+  board_to_bits(game->board, t->board);
+
+  t->episode = episode;
+  t->step = game->pieces;
+  t->piece = game->current.type;
+  t->preview = game->preview.type;
+  t->rotation = game->current.rotation_state;
+  t->x = game->current.center_x;
+  t->y = game->current.center_y;
+}
+
+
+void end_transition(struct Game *game, long score_before, struct Transition *t)
+{
+  t->reward = game->score - score_before;
+  t->done = game->gameover;
+}
+
+
+
+/*
+ * Event Log
+ */
+
+
+size_t encode_varint(unsigned char *out, int64_t value)
+{
+  /* Zigzag mapping, so that small negative deltas stay short too */
+  uint64_t u = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  size_t n = 0;
+
+  while (u >= 0x80) {
+    out[n++] = (u & 0x7F) | 0x80;
+    u >>= 7;
+  }
+  out[n++] = u;
+
+  return n;
+}
+
+
+size_t decode_varint(const unsigned char *in, size_t len, int64_t *value)
+{
+  uint64_t u = 0;
+
+  for (size_t n = 0; n < len && n < 10; ++n) {
+    u |= (uint64_t)(in[n] & 0x7F) << (7 * n);
+    if (!(in[n] & 0x80)) {
+      *value = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+      return n + 1;
+    }
+  }
+
+  return 0;			/* Truncated or malformed */
+}
+
+
+void write_all(int fd, const void *buf, size_t len)
+{
+  for (size_t written = 0; written < len; ) {
+    ssize_t n = write(fd, (const char *)buf + written, len - written);
+    if (n < 0 && errno == EINTR) continue;
+    Die(n < 0);
+    written += n;
+  }
+}
+
+
+void *event_log_io_thread(void *arg)
+{
+  struct EventLog *log = arg;
+
+  pthread_mutex_lock(&log->lock);
+
+  while (true) {
+
+    /* Swap out a nearly full buffer, or whatever is there when flushing or closing */
+    if (log->pending == NULL && log->filling->len > 0
+	&& (log->filling->len + MAX_EVENT_LEN > EVENT_LOG_BUF_LEN
+	    || log->flushing || log->closing)) {
+      log->pending = log->filling;
+      log->filling = log->filling == &log->buffer[0] ? &log->buffer[1] : &log->buffer[0];
+      log->flushing = false;
+    }
+
+    if (log->pending == NULL) {
+      if (log->closing) break;
+      pthread_cond_wait(&log->wakeup, &log->lock);
+      continue;
+    }
+
+    /* write() happens with the lock released */
+    pthread_mutex_unlock(&log->lock);
+    write_all(log->fd, log->pending->bytes, log->pending->len);
+    pthread_mutex_lock(&log->lock);
+
+    log->pending->len = 0;
+    log->pending = NULL;
+  }
+
+  pthread_mutex_unlock(&log->lock);
+
+  return NULL;
+}
+
+
+struct EventLog *open_event_log(const char *path)
+{
+  struct EventLog *log = calloc(1, sizeof(*log));
+  Die(log == NULL);
+
+  log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  Die(log->fd < 0);
+
+  for (int i = 0; i < 2; ++i) {
+    log->buffer[i].cap = EVENT_LOG_BUF_LEN;
+    log->buffer[i].bytes = malloc(EVENT_LOG_BUF_LEN);
+    Die(log->buffer[i].bytes == NULL);
+  }
+
+  log->filling = &log->buffer[0];
+  log->pending = NULL;
+  log->last_time = -1.;		/* The first event sets the time base */
+
+  /* Only a brand new file gets the signature: sessions are appended to the same stream */
+  struct stat st;
+  Die(fstat(log->fd, &st) < 0);
+
+  if (st.st_size == 0) {
+    memcpy(log->filling->bytes, EVENT_LOG_MAGIC, sizeof(EVENT_LOG_MAGIC) - 1);
+    log->filling->bytes[sizeof(EVENT_LOG_MAGIC) - 1] = EVENT_LOG_VERSION;
+    log->filling->len = sizeof(EVENT_LOG_MAGIC);
+  }
+
+  pthread_mutex_init(&log->lock, NULL);
+  pthread_cond_init(&log->wakeup, NULL);
+
+  errno = pthread_create(&log->thread, NULL, &event_log_io_thread, log);
+  Die(errno != 0);
+
+  return log;
+}
+
+
+void log_event(struct EventLog *log, enum EventType type, double time, ...)
+{
+  if (log == NULL) return;
+
+  pthread_mutex_lock(&log->lock);
+
+  struct EventBuffer *b = log->filling;
+
+  /* If the disk falls behind, the buffer just grows: the game never waits for it */
+  if (b->len + MAX_EVENT_LEN > b->cap) {
+    b->cap *= 2;
+    b->bytes = realloc(b->bytes, b->cap);
+    Die(b->bytes == NULL);
+  }
+
+  unsigned char *p = b->bytes + b->len;
+
+  if (log->last_time < 0.) log->last_time = time;
+
+  *p++ = type;
+  p += encode_varint(p, (int64_t)(1e6 * (time - log->last_time)));
+  log->last_time = time;
+
+  va_list fields;
+  va_start(fields, time);
+  for (int i = 0; i < event_num_fields[type]; ++i) {
+    p += encode_varint(p, va_arg(fields, long));
+  }
+  va_end(fields);
+
+  b->len = p - b->bytes;
+
+  if (b->len + MAX_EVENT_LEN > EVENT_LOG_BUF_LEN) pthread_cond_signal(&log->wakeup);
+
+  pthread_mutex_unlock(&log->lock);
+}
+
+
+void flush_event_log(struct EventLog *log)
+{
+  if (log == NULL) return;
+
+  /* Only asks the I/O thread: the events reach the disk without the caller waiting */
+  pthread_mutex_lock(&log->lock);
+  log->flushing = true;
+  pthread_cond_signal(&log->wakeup);
+  pthread_mutex_unlock(&log->lock);
+}
+
+
+void close_event_log(struct EventLog *log)
+{
+  if (log == NULL) return;
+
+  pthread_mutex_lock(&log->lock);
+  log->closing = true;
+  pthread_cond_signal(&log->wakeup);
+  pthread_mutex_unlock(&log->lock);
+
+  pthread_join(log->thread, NULL);
+
+  pthread_cond_destroy(&log->wakeup);
+  pthread_mutex_destroy(&log->lock);
+  free(log->buffer[0].bytes);
+  free(log->buffer[1].bytes);
+  close(log->fd);
+  free(log);
+}
+
+
+struct PlayerStats *find_player_stats(struct PlayerStats **players, int *num_players,
+				      const char *name)
+{
+  for (int i = 0; i < *num_players; ++i) {
+    if (strncmp((*players)[i].name, name, NAME_BUF_LEN) == 0) return &(*players)[i];
+  }
+
+  *players = realloc(*players, (*num_players + 1) * sizeof(**players));
+  Die(*players == NULL);
+
+  struct PlayerStats *p = &(*players)[(*num_players)++];
+  memset(p, 0, sizeof(*p));
+  strncpy(p->name, name, NAME_BUF_LEN);
+
+  return p;
+}
+
+
+/* Scan one memory-mapped log, accumulating the games into the per-player table */
+bool scan_event_log(const unsigned char *data, size_t size,
+		    struct PlayerStats **players, int *num_players)
+{
+  if (size < sizeof(EVENT_LOG_MAGIC)
+      || memcmp(data, EVENT_LOG_MAGIC, sizeof(EVENT_LOG_MAGIC) - 1) != 0
+      || data[sizeof(EVENT_LOG_MAGIC) - 1] != EVENT_LOG_VERSION) {
+    return false;
+  }
+
+  struct PlayerStats game = { 0 };	/* The game in progress, credited at gameover */
+  double time = 0.;
+  double spawn_time = 0.;
+
+  for (size_t pos = sizeof(EVENT_LOG_MAGIC); pos < size; ) {
+
+    enum EventType type = data[pos++];
+    if (type <= 0 || type >= MAX_EVENT_TYPE) return false;
+
+    int64_t field[1 + MAX_EVENT_FIELDS];
+
+    for (int i = 0; i < 1 + event_num_fields[type]; ++i) {
+      size_t n = decode_varint(data + pos, size - pos, &field[i]);
+      if (n == 0) return false;
+      pos += n;
+    }
+
+    time += 1e-6 * field[0];
+
+    switch (type) {
+
+    case EV_GAME_START:
+      memset(&game, 0, sizeof(game));
       break;
-    } else if (toupper(ch) == 'Q') {
-      next_state = STATE_QUIT;
+
+    case EV_SPAWN:
+      spawn_time = time;
+      if (field[1] > 0 && field[1] <= MAX_TYPES) game.type_count[field[1]] += 1;
+      break;
+
+    case EV_LOCK:
+      game.pieces += 1;
+      game.piece_time += time - spawn_time;
+      break;
+
+    case EV_ROWS:
+      if (field[1] > 0 && field[1] <= MAX_BLOCKS) game.clear_count[field[1]] += 1;
+      break;
+
+    case EV_GAMEOVER: {
+      char name[NAME_BUF_LEN] = { field[2] >> 16, field[2] >> 8, field[2], '\0' };
+      struct PlayerStats *p = find_player_stats(players, num_players, name);
+
+      p->games += 1;
+      p->pieces += game.pieces;
+      p->total_score += field[1];
+      p->best_score = Max(p->best_score, field[1]);
+      p->piece_time += game.piece_time;
+      for (int i = 0; i <= MAX_TYPES; ++i) p->type_count[i] += game.type_count[i];
+      for (int i = 0; i <= MAX_BLOCKS; ++i) p->clear_count[i] += game.clear_count[i];
+      break;
+    }
+
+    default:
       break;
     }
   }
 
-  return next_state;
+  return true;
+}
+
+
+int event_log_stats(int num_paths, char *paths[])
+{
+  struct PlayerStats *players = NULL;
+  int num_players = 0;
+
+  for (int i = 0; i < num_paths; ++i) {
+
+    int fd = open(paths[i], O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      fprintf(stderr, "%s: %s\n", paths[i], strerror(errno));
+      return EXIT_FAILURE;
+    }
+
+    if (st.st_size == 0) {
+      close(fd);
+      continue;
+    }
+
+    const unsigned char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    Die(data == MAP_FAILED);
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    bool ok = scan_event_log(data, st.st_size, &players, &num_players);
+
+    munmap((void *)data, st.st_size);
+    close(fd);
+
+    if (!ok) fprintf(stderr, "%s: not a valid event log (or truncated)\n", paths[i]);
+  }
+
+  const char type_name[1 + MAX_TYPES] = " IJLSZOT";
+
+  for (int i = 0; i < num_players; ++i) {
+
+    struct PlayerStats *p = &players[i];
+    long spawned = 0;
+    for (int k = 1; k <= MAX_TYPES; ++k) spawned += p->type_count[k];
+
+    printf("%s  games %ld  best %ld  mean score %.1f  pieces %ld  time/piece %.3fs\n",
+	   p->name, p->games, p->best_score, (double)p->total_score / p->games,
+	   p->pieces, p->pieces ? p->piece_time / p->pieces : 0.);
+
+    printf("     pieces:");
+    for (int k = 1; k <= MAX_TYPES; ++k) {
+      printf(" %c %.1f%%", type_name[k], spawned ? 100. * p->type_count[k] / spawned : 0.);
+    }
+
+    printf("\n     clears: single %ld  double %ld  triple %ld  tetris %ld\n",
+	   p->clear_count[1], p->clear_count[2], p->clear_count[3], p->clear_count[4]);
+  }
+
+  free(players);
+
+  return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * Spectator Broadcast
+ */
+
+
+void write_keyframe(struct Broadcast *bc)
+{
+  struct BroadcastRing *ring = bc->ring;
+  uint64_t seq = atomic_load_explicit(&ring->keyframe_seq, memory_order_relaxed);
+
+  atomic_store_explicit(&ring->keyframe_seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  ring->keyframe.pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  ring->keyframe.score = bc->score;
+  ring->keyframe.speed = bc->speed;
+  ring->keyframe.preview = bc->preview;
+  memcpy(ring->keyframe.cells, bc->cells, sizeof(bc->cells));
+
+  atomic_store_explicit(&ring->keyframe_seq, seq + 2, memory_order_release);
+}
+
+
+struct Broadcast *open_broadcast(void)
+{
+  struct Broadcast *bc = calloc(1, sizeof(*bc));
+  Die(bc == NULL);
+
+  /*
+   * The ring has a single producer, so every game broadcasts on a segment of its own. One
+   * left with this process id can only come from a process that is gone. Other users may
+   * watch, but not write.
+   */
+  snprintf(bc->name, sizeof(bc->name), BROADCAST_SHM_NAME, (unsigned)getuid(), (int)getpid());
+  shm_unlink(bc->name);
+
+  int fd = shm_open(bc->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  Die(fd < 0);
+  Die(ftruncate(fd, sizeof(*bc->ring)) < 0);
+
+  bc->ring = mmap(NULL, sizeof(*bc->ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  Die(bc->ring == MAP_FAILED);
+  close(fd);
+
+  struct BroadcastRing *ring = bc->ring;
+
+  ring->height = BOARD_HEIGHT;
+  ring->width = BOARD_WIDTH;
+  ring->owner = getpid();
+  write_keyframe(bc);
+  ring->magic = BROADCAST_MAGIC;
+
+  return bc;
+}
+
+
+void close_broadcast(struct Broadcast *bc)
+{
+  if (bc == NULL) return;
+
+  /* Watchers keep their mapping, and see the flag */
+  atomic_store_explicit(&bc->ring->ended, true, memory_order_release);
+  munmap(bc->ring, sizeof(*bc->ring));
+  shm_unlink(bc->name);
+  free(bc);
+}
+
+
+void push_frame_event(struct BroadcastRing *ring, int kind, int y, int x, int64_t value)
+{
+  uint64_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  struct BroadcastSlot *slot = &ring->slot[pos & (BROADCAST_RING_LEN - 1)];
+
+  atomic_store_explicit(&slot->seq, 2 * pos + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  slot->event = (struct FrameEvent){ .kind = kind, .y = y, .x = x, .value = value };
+
+  atomic_store_explicit(&slot->seq, 2 * pos + 2, memory_order_release);
+  atomic_store_explicit(&ring->head, pos + 1, memory_order_release);
+}
+
+
+void publish_frame(struct Broadcast *bc, WINDOW *board_win, long score, double speed,
+		   enum TetrominoType preview)
+{
+  if (bc == NULL) return;
+
+  bool changed = false;
+
+  /* Diff what is actually on screen, so that anything drawn is mirrored faithfully */
+  for (int y = 0; y < BOARD_HEIGHT; ++y) {
+    for (int x = 0; x < BOARD_WIDTH; ++x) {
+
+      chtype ch = mvwinch(board_win, y, x);
+      uint8_t cell = (ch & A_CHARTEXT) == ' ' ? 0 : Max(PAIR_NUMBER(ch & A_COLOR), 1);
+
+      if (cell != bc->cells[y][x]) {
+	bc->cells[y][x] = cell;
+	push_frame_event(bc->ring, FRAME_CELL, y, x, cell);
+	changed = true;
+      }
+    }
+  }
+
+  if (score != bc->score) {
+    bc->score = score;
+    push_frame_event(bc->ring, FRAME_SCORE, 0, 0, score);
+    changed = true;
+  }
+
+  if ((int64_t)(1000. * speed) != bc->speed) {
+    bc->speed = 1000. * speed;
+    push_frame_event(bc->ring, FRAME_SPEED, 0, 0, bc->speed);
+    changed = true;
+  }
+
+  if (preview != bc->preview) {
+    bc->preview = preview;
+    push_frame_event(bc->ring, FRAME_PREVIEW, 0, 0, preview);
+    changed = true;
+  }
+
+  if (changed) {
+    push_frame_event(bc->ring, FRAME_END, 0, 0, 0);
+    write_keyframe(bc);
+  }
+}
+
+
+bool read_keyframe(struct BroadcastRing *ring, struct Keyframe *copy)
+{
+  /* A producer that died halfway through the keyframe leaves it odd for good */
+  for (int waited = 0; waited < BROADCAST_STALL_MS; ++waited) {
+
+    uint64_t seq = atomic_load_explicit(&ring->keyframe_seq, memory_order_acquire);
+
+    if (!(seq & 1)) {		/* Else the producer is halfway through it */
+
+      *copy = ring->keyframe;
+      atomic_thread_fence(memory_order_acquire);
+
+      if (atomic_load_explicit(&ring->keyframe_seq, memory_order_relaxed) == seq) return true;
+    }
+
+    napms(1);
+  }
+
+  return false;
+}
+
+
+bool broadcast_alive(struct BroadcastRing *ring)
+{
+  return !atomic_load_explicit(&ring->ended, memory_order_acquire)
+    && (kill(ring->owner, 0) == 0 || errno != ESRCH);
+}
+
+
+int find_broadcast(char *name, size_t len)
+{
+  DIR *dir = opendir(BROADCAST_SHM_DIR);
+  if (dir == NULL) return 0;
+
+  int found = 0, first_pid = 0;
+  unsigned first_uid = 0;
+  struct dirent *entry;
+
+  while ((entry = readdir(dir)) != NULL) {
+
+    char path[NAME_MAX + 2];
+    unsigned uid;
+    int pid, end = 0;
+
+    snprintf(path, sizeof(path), "/%s", entry->d_name);
+
+    if (sscanf(path, BROADCAST_SHM_NAME "%n", &uid, &pid, &end) != 2 || path[end] != '\0') {
+      continue;
+    }
+
+    /* Left by a player that crashed: ours are cleaned up, other users' skipped */
+    if (kill(pid, 0) < 0 && errno == ESRCH) {
+      if (uid == getuid()) shm_unlink(path);
+      continue;
+    }
+
+    if (options.watch_pid != 0 && pid != options.watch_pid) continue;
+
+    if (++found == 1) {
+      snprintf(name, len, "%s", path);
+      first_pid = pid;
+      first_uid = uid;
+      continue;
+    }
+
+    if (found == 2) {
+      fprintf(stderr, "Several games are being broadcast, pick one with --watch=PID:\n");
+      fprintf(stderr, "  %d (user id %u)\n", first_pid, first_uid);
+    }
+
+    fprintf(stderr, "  %d (user id %u)\n", pid, uid);
+  }
+
+  closedir(dir);
+
+  return found;
+}
+
+
+void draw_keyframe(struct Keyframe *frame, WINDOW *board_win, WINDOW *preview_win,
+		   WINDOW *side_win)
+{
+  for (int y = 0; y < BOARD_HEIGHT; ++y) {
+    for (int x = 0; x < BOARD_WIDTH; ++x) {
+      wcolor_set(board_win, frame->cells[y][x], NULL);
+      mvwaddch(board_win, y, x, frame->cells[y][x] ? ACS_DIAMOND : ' ');
+    }
+  }
+
+  werase(preview_win);
+  box(preview_win, ACS_VLINE, ACS_HLINE);
+
+  if (frame->preview > 0 && frame->preview <= MAX_TYPES) {
+    free(new_tetromino(frame->preview, PREVIEW_WIN_SIDE / 2 - 1, PREVIEW_WIN_SIDE / 2,
+		       preview_win));
+  }
+
+  draw_updated_stats(side_win, frame->score, frame->speed / 1000.);
+
+  wnoutrefresh(side_win);
+  wnoutrefresh(preview_win);
+  wnoutrefresh(board_win);
+  doupdate();
+}
+
+
+int watch_screen(void)
+{
+  char name[NAME_MAX + 2];
+  int found = find_broadcast(name, sizeof(name));
+
+  if (found == 0) fprintf(stderr, "No game is being broadcast\n");
+  if (found != 1) return EXIT_FAILURE;
+
+  int fd = shm_open(name, O_RDONLY, 0);
+
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s\n", name, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  struct BroadcastRing *ring = mmap(NULL, sizeof(*ring), PROT_READ, MAP_SHARED, fd, 0);
+  Die(ring == MAP_FAILED);
+  close(fd);
+
+  if (ring->magic != BROADCAST_MAGIC || ring->height != BOARD_HEIGHT
+      || ring->width != BOARD_WIDTH) {
+    fprintf(stderr, "Incompatible broadcast segment %s\n", name);
+    return EXIT_FAILURE;
+  }
+
+  initialize();
+
+  /* Same layout as the game screen */
+  int screen_height, screen_width;
+  getmaxyx(stdscr, screen_height, screen_width);
+
+  int field_width = 2 * screen_width / 3;
+  int board_origin_y = (screen_height - BOARD_HEIGHT) / 2;
+  int board_origin_x = (field_width - BOARD_WIDTH) / 2;
+
+  WINDOW *side_win = newwin(screen_height, screen_width - field_width, 0, field_width);
+  WINDOW *board_win = newwin(BOARD_HEIGHT, BOARD_WIDTH, board_origin_y, board_origin_x);
+  WINDOW *preview_win = newwin(PREVIEW_WIN_SIDE, PREVIEW_WIN_SIDE, board_origin_y,
+			       board_origin_x + BOARD_WIDTH + 4);
+
+  clear();
+  draw_board(stdscr, board_origin_y, board_origin_x, BOARD_HEIGHT, BOARD_WIDTH);
+  mvaddstr(1, 2, "WATCHING. Press [Q] to quit.");
+  box(side_win, ACS_VLINE, ACS_HLINE);
+  wnoutrefresh(stdscr);
+
+  /* Start from the keyframe; 'frame' accumulates diffs until the next FRAME_END */
+  struct Keyframe shown, frame;
+  const char *ended = NULL;
+
+  if (!read_keyframe(ring, &shown)) ended = "The broadcast has stalled.";
+
+  frame = shown;
+  uint64_t pos = shown.pos;
+  bool dirty = true;
+
+  while (ended == NULL && toupper(getch()) != 'Q') {
+
+    /* Checked first, so that whatever the player published last is still shown */
+    bool alive = broadcast_alive(ring);
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    bool resync = head - pos > BROADCAST_RING_LEN; /* Lapped: the slots are long gone */
+
+    for (; pos < head && !resync; ++pos) {
+
+      struct BroadcastSlot *slot = &ring->slot[pos & (BROADCAST_RING_LEN - 1)];
+      uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+      struct FrameEvent ev = slot->event;
+      atomic_thread_fence(memory_order_acquire);
+
+      /* A slot tagged with another position has been overwritten by the producer */
+      if (seq != 2 * pos + 2
+	  || atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+	resync = true;
+	break;
+      }
+
+      switch (ev.kind) {
+      case FRAME_CELL:
+	if (ev.y < BOARD_HEIGHT && ev.x < BOARD_WIDTH) frame.cells[ev.y][ev.x] = ev.value;
+	break;
+      case FRAME_SCORE: frame.score = ev.value; break;
+      case FRAME_SPEED: frame.speed = ev.value; break;
+      case FRAME_PREVIEW: frame.preview = ev.value; break;
+      case FRAME_END:
+	shown = frame;
+	dirty = true;
+	break;
+      }
+    }
+
+    if (resync && !read_keyframe(ring, &shown)) {
+      ended = "The broadcast has stalled.";
+    } else if (resync) {
+      frame = shown;
+      pos = shown.pos;
+      dirty = true;
+    }
+
+    if (dirty) {
+      draw_keyframe(&shown, board_win, preview_win, side_win);
+      dirty = false;
+    }
+
+    if (!alive && ended == NULL) ended = "The broadcast has ended.";
+
+    napms(WATCH_POLL_MS);
+  }
+
+  if (ended != NULL) {
+    mvprintw(1, 2, "%s Press any key.    ", ended);
+    refresh();
+    nodelay(stdscr, false);
+    getch();
+  }
+
+  delwin(preview_win);
+  delwin(board_win);
+  delwin(side_win);
+  munmap(ring, sizeof(*ring));
+
+  return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * Leaderboard
+ */
+
+
+void init_leaderboard(struct Leaderboard *leaderboard)
+{
+  struct Ranking defaults[MAX_RANKINGS] = INIT_RANKINGS;
+  memcpy(leaderboard->rankings, defaults, sizeof(defaults));
+  atomic_store(&leaderboard->seq, 0);
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&leaderboard->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  atomic_store_explicit(&leaderboard->magic, LEADERBOARD_MAGIC, memory_order_release);
+}
+
+
+struct Leaderboard *open_leaderboard(void)
+{
+  struct Leaderboard *leaderboard = MAP_FAILED;
+
+  /* Private to the user: anyone who can write the segment can wedge or rewrite it */
+  char name[NAME_MAX];
+  snprintf(name, sizeof(name), LEADERBOARD_SHM_NAME, (unsigned)getuid());
+
+  int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+
+  if (fd >= 0) {
+    if (ftruncate(fd, sizeof(*leaderboard)) == 0) {
+      leaderboard = mmap(NULL, sizeof(*leaderboard), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+  }
+
+  /*
+   * A fresh segment is zero-filled: the first process to claim it fills in the defaults.
+   * If that one died before it was done, another claims it in turn. A creator that seems
+   * alive but never finishes (a recycled pid, say) is given up on: the rankings are then
+   * kept for this process only, as without shared memory.
+   */
+  double deadline = get_real_time() + LEADERBOARD_INIT_TIMEOUT;
+
+  while (leaderboard != MAP_FAILED
+	 && atomic_load_explicit(&leaderboard->magic, memory_order_acquire) != LEADERBOARD_MAGIC) {
+
+    int32_t owner = atomic_load(&leaderboard->owner);
+    bool dead = owner != 0 && kill(owner, 0) < 0 && errno == ESRCH;
+
+    if ((owner == 0 || dead) && atomic_compare_exchange_strong(&leaderboard->owner, &owner,
+							      (int32_t)getpid())) {
+      init_leaderboard(leaderboard);
+    } else if (get_real_time() > deadline) {
+      munmap(leaderboard, sizeof(*leaderboard));
+      leaderboard = MAP_FAILED;
+    } else {
+      napms(1);
+    }
+  }
+
+  if (leaderboard == MAP_FAILED) {
+    leaderboard = calloc(1, sizeof(*leaderboard));
+    Die(leaderboard == NULL);
+    init_leaderboard(leaderboard);
+  }
+
+  return leaderboard;
+}
+
+
+void lock_leaderboard(struct Leaderboard *leaderboard)
+{
+  if (pthread_mutex_lock(&leaderboard->lock) != EOWNERDEAD) return;
+
+  /* The last writer died holding the mutex: if it was halfway, put the table back */
+  uint64_t seq = atomic_load_explicit(&leaderboard->seq, memory_order_relaxed);
+
+  if (seq & 1) {
+    memcpy(leaderboard->rankings, leaderboard->backup, sizeof(leaderboard->rankings));
+    atomic_store_explicit(&leaderboard->seq, seq + 1, memory_order_release);
+  }
+
+  pthread_mutex_consistent(&leaderboard->lock);
+}
+
+
+void read_rankings(struct Leaderboard *leaderboard, struct Ranking rankings[MAX_RANKINGS])
+{
+  while (true) {
+    uint64_t seq = atomic_load_explicit(&leaderboard->seq, memory_order_acquire);
+
+    /* A writer is halfway through an insertion: wait for its turn to end (or repair it) */
+    if (seq & 1) {
+      lock_leaderboard(leaderboard);
+      pthread_mutex_unlock(&leaderboard->lock);
+      continue;
+    }
+
+    memcpy(rankings, leaderboard->rankings, sizeof(leaderboard->rankings));
+    atomic_thread_fence(memory_order_acquire);
+
+    if (atomic_load_explicit(&leaderboard->seq, memory_order_relaxed) == seq) return;
+  }
+}
+
+
+bool top_score(struct Leaderboard *leaderboard, long new_score)
+{
+  struct Ranking rankings[MAX_RANKINGS];
+  read_rankings(leaderboard, rankings);
+
+  return new_score > rankings[MAX_RANKINGS - 1].score;
+}
+
+
+void record_ranking(struct Leaderboard *leaderboard, char *new_name, long new_score)
+{
+  /* Take the writer's turn, keep the table to restore, then make the sequence number odd */
+  lock_leaderboard(leaderboard);
+
+  memcpy(leaderboard->backup, leaderboard->rankings, sizeof(leaderboard->backup));
+
+  uint64_t seq = atomic_load_explicit(&leaderboard->seq, memory_order_relaxed);
+  atomic_store_explicit(&leaderboard->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  /*
+   * The table is always sorted, so one insertion step replaces the full sort. Another
+   * instance may have raised the bar since top_score(): then nothing is inserted.
+   */
+  struct Ranking *rankings = leaderboard->rankings;
+  int i = 0;
+
+  while (i < MAX_RANKINGS && rankings[i].score >= new_score) ++i;
+
+  if (i < MAX_RANKINGS) {
+    memmove(&rankings[i + 1], &rankings[i], (MAX_RANKINGS - 1 - i) * sizeof(*rankings));
+    strncpy(rankings[i].name, new_name, NAME_BUF_LEN);
+    rankings[i].score = new_score;
+  }
+
+  atomic_store_explicit(&leaderboard->seq, seq + 2, memory_order_release);
+
+  pthread_mutex_unlock(&leaderboard->lock);
+}
+
+
+
+/*
+ * Score Index
+ */
+
+
+bool lock_score_index(struct ScoreIndex *index, int operation)
+{
+  if (flock(index->fd, operation) < 0) return false;
+
+  /* Another process may have grown the file since: follow it */
+  if (index->header->capacity != index->capacity) {
+
+    size_t len = score_index_size(index->header->capacity);
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, index->fd, 0);
+
+    if (map == MAP_FAILED) {
+      flock(index->fd, LOCK_UN);
+      return false;
+    }
+
+    munmap(index->header, score_index_size(index->capacity));
+    index->header = map;
+    index->nodes = (struct ScoreNode *)(index->header + 1);
+    index->capacity = index->header->capacity;
+  }
+
+  /* A writer died halfway through linking a node: relink them all, as the writer */
+  if (index->header->dirty) {
+
+    /* Converting a flock isn't atomic: once relinked, start over with the lock asked for */
+    if (operation != LOCK_EX) {
+      return lock_score_index(index, LOCK_EX) && lock_score_index(index, operation);
+    }
+
+    rebuild_score_index(index);
+  }
+
+  return true;
+}
+
+
+void unlock_score_index(struct ScoreIndex *index)
+{
+  flock(index->fd, LOCK_UN);
+}
+
+
+size_t score_index_size(uint64_t capacity)
+{
+  /* Node 0 is the empty subtree */
+  return sizeof(struct ScoreIndexHeader) + (capacity + 1) * sizeof(struct ScoreNode);
+}
+
+
+struct ScoreIndex *open_score_index(const char *path)
+{
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return NULL;
+
+  struct stat st;
+
+  if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  /* A new file gets its header under the lock, so no one sees it half made */
+  if (st.st_size == 0) {
+
+    struct ScoreIndexHeader header = {
+      .magic = SCORE_INDEX_MAGIC,
+      .version = SCORE_INDEX_VERSION,
+      .root = 0,
+      .count = 0,
+      .capacity = SCORE_INDEX_INITIAL,
+      .dirty = 0
+    };
+
+    if (ftruncate(fd, score_index_size(header.capacity)) < 0
+	|| pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+      close(fd);
+      return NULL;
+    }
+
+    st.st_size = score_index_size(header.capacity);
+  }
+
+  struct ScoreIndexHeader header;
+
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+      || memcmp(header.magic, SCORE_INDEX_MAGIC, sizeof(header.magic)) != 0
+      || header.version != SCORE_INDEX_VERSION
+      || (size_t)st.st_size < score_index_size(header.capacity)
+      || header.count > header.capacity || header.root > header.count) {
+    fprintf(stderr, "%s: not a score index\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  struct ScoreIndex *index = malloc(sizeof(*index));
+  Die(index == NULL);
+
+  index->fd = fd;
+  index->capacity = header.capacity;
+  index->header = mmap(NULL, score_index_size(header.capacity), PROT_READ | PROT_WRITE,
+		       MAP_SHARED, fd, 0);
+  Die(index->header == MAP_FAILED);
+  index->nodes = (struct ScoreNode *)(index->header + 1);
+
+  if (index->header->dirty) rebuild_score_index(index);
+
+  flock(fd, LOCK_UN);
+
+  return index;
+}
+
+
+void close_score_index(struct ScoreIndex *index)
+{
+  if (index == NULL) return;
+
+  munmap(index->header, score_index_size(index->capacity));
+  close(index->fd);
+  free(index);
+}
+
+
+uint32_t score_node_size(struct ScoreNode *nodes, uint32_t n)
+{
+  return n == 0 ? 0 : nodes[n].size;
+}
+
+
+uint32_t rotate_score_node(struct ScoreNode *nodes, uint32_t n, bool right)
+{
+  /* The child on the 'right ? left : right' side takes the place of n */
+  uint32_t c = right ? nodes[n].left : nodes[n].right;
+
+  if (right) {
+    nodes[n].left = nodes[c].right;
+    nodes[c].right = n;
+  } else {
+    nodes[n].right = nodes[c].left;
+    nodes[c].left = n;
+  }
+
+  nodes[c].size = nodes[n].size;
+  nodes[n].size = 1 + score_node_size(nodes, nodes[n].left) + score_node_size(nodes, nodes[n].right);
+
+  return c;
+}
+
+
+uint32_t insert_score_node(struct ScoreNode *nodes, uint32_t root, uint32_t n)
+{
+  if (root == 0) return n;
+
+  nodes[root].size += 1;
+
+  /* Higher scores first; an equal score ranks after the older ones */
+  if (nodes[n].score > nodes[root].score) {
+    nodes[root].left = insert_score_node(nodes, nodes[root].left, n);
+    if (nodes[nodes[root].left].priority > nodes[root].priority) {
+      root = rotate_score_node(nodes, root, true);
+    }
+  } else {
+    nodes[root].right = insert_score_node(nodes, nodes[root].right, n);
+    if (nodes[nodes[root].right].priority > nodes[root].priority) {
+      root = rotate_score_node(nodes, root, false);
+    }
+  }
+
+  return root;
+}
+
+
+void rebuild_score_index(struct ScoreIndex *index)
+{
+  struct ScoreIndexHeader *header = index->header;
+
+  /* Every node up to the count is complete: only the links may be half updated */
+  header->root = 0;
+
+  for (uint32_t n = 1; n <= header->count; ++n) {
+    index->nodes[n].left = index->nodes[n].right = 0;
+    index->nodes[n].size = 1;
+    header->root = insert_score_node(index->nodes, header->root, n);
+  }
+
+  atomic_signal_fence(memory_order_seq_cst);
+  header->dirty = 0;
+}
+
+
+long rank_in_score_index(struct ScoreIndex *index, long score)
+{
+  long rank = 1;
+
+  /* A new game ranks after every higher or equal score */
+  for (uint32_t n = index->header->root; n != 0; ) {
+    if (index->nodes[n].score >= score) {
+      rank += 1 + score_node_size(index->nodes, index->nodes[n].left);
+      n = index->nodes[n].right;
+    } else {
+      n = index->nodes[n].left;
+    }
+  }
+
+  return rank;
+}
+
+
+long score_index_insert(struct ScoreIndex *index, const char *name, long score, time_t when,
+			long *total)
+{
+  if (index == NULL || !lock_score_index(index, LOCK_EX)) return 0;
+
+  struct ScoreIndexHeader *header = index->header;
+
+  if (header->count == header->capacity) { /* Full: double the file */
+
+    uint64_t capacity = 2 * header->capacity;
+
+    if (ftruncate(index->fd, score_index_size(capacity)) < 0) {
+      unlock_score_index(index);
+      return 0;
+    }
+
+    header->capacity = capacity;
+
+    if (!lock_score_index(index, LOCK_EX)) return 0; /* Remaps, keeping the lock */
+    header = index->header;
+  }
+
+  /* Ranked under the same lock as the insertion, so two games never get the same rank */
+  long rank = rank_in_score_index(index, score);
+
+  uint32_t n = header->count + 1;
+  struct ScoreNode *node = &index->nodes[n];
+
+  /* Treap priorities from the node number: balanced in expectation, and reproducible */
+  uint64_t state = n;
+
+  node->score = score;
+  node->time = when;
+  node->left = node->right = 0;
+  node->size = 1;
+  node->priority = (uint32_t)next_random(&state);
+  snprintf(node->name, sizeof(node->name), "%s", name);
+
+  /*
+   * The node is complete before it is counted, and the links are only trusted once
+   * 'dirty' is clear again: a writer killed in between leaves them to be rebuilt. The
+   * fences keep the compiler from reordering the stores, a crash of the whole machine is
+   * not covered.
+   */
+  atomic_signal_fence(memory_order_seq_cst);
+  header->dirty = 1;
+  atomic_signal_fence(memory_order_seq_cst);
+  header->count = n;
+  header->root = insert_score_node(index->nodes, header->root, n);
+  atomic_signal_fence(memory_order_seq_cst);
+  header->dirty = 0;
+
+  if (total != NULL) *total = header->count;
+
+  unlock_score_index(index);
+
+  return rank;
+}
+
+
+long score_index_count(struct ScoreIndex *index)
+{
+  if (index == NULL || !lock_score_index(index, LOCK_SH)) return 0;
+
+  long count = index->header->count;
+
+  unlock_score_index(index);
+
+  return count;
+}
+
+
+long score_index_rank(struct ScoreIndex *index, long score)
+{
+  if (index == NULL || !lock_score_index(index, LOCK_SH)) return 0;
+
+  long rank = rank_in_score_index(index, score);
+
+  unlock_score_index(index);
+
+  return rank;
+}
+
+
+int score_index_page(struct ScoreIndex *index, long first, int len, struct ScoreNode *page,
+		     long *total)
+{
+  if (index == NULL || !lock_score_index(index, LOCK_SH)) return 0;
+
+  int found = 0;
+
+  for (long k = first; found < len && k < (long)index->header->count; ++k) {
+
+    /* Select the k-th (from 0) by subtree sizes */
+    uint32_t n = index->header->root;
+    long rest = k;
+
+    while (n != 0) {
+      long left = score_node_size(index->nodes, index->nodes[n].left);
+      if (rest < left) {
+	n = index->nodes[n].left;
+      } else if (rest == left) {
+	break;
+      } else {
+	rest -= left + 1;
+	n = index->nodes[n].right;
+      }
+    }
+
+    page[found++] = index->nodes[n];
+  }
+
+  if (total != NULL) *total = index->header->count;
+
+  unlock_score_index(index);
+
+  return found;
+}
+
+
+
+/*
+ * Suspend and Resume
+ */
+
+
+void request_suspend(int sig)
+{
+  (void)sig;
+  suspend_requested = 1;
+}
+
+
+bool save_game(struct Game *game, double remaining, const char *path)
+{
+  struct SavedGame saved;
+  memset(&saved, 0, sizeof(saved)); /* Padding included, for a stable checksum */
+
+  memcpy(saved.magic, SAVE_MAGIC, sizeof(saved.magic));
+  saved.version = SAVE_VERSION;
+  saved.height = game->board->height;
+  saved.current = game->current;
+  saved.preview = game->preview;
+  saved.rng = game->rng;
+  saved.score = game->score;
+  saved.lines = game->lines;
+  saved.pieces = game->pieces;
+  /* Gravity may be a little overdue, or the clock rounded */
+  saved.remaining = Min(Max(remaining, 0.), 1. / game->difficulty->initial_speed);
+  saved.difficulty = *game->difficulty;
+
+  saved.checksum = crc32(0L, (const Bytef *)&saved.height,
+			 sizeof(saved) - offsetof(struct SavedGame, height));
+
+  for (int y = 0; y < saved.height; ++y) {
+    saved.checksum = crc32(saved.checksum, board_row(game->board, y), BOARD_WIDTH);
+  }
+
+  /* Written aside and renamed into place, so a crash never leaves half a file behind */
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+
+  bool ok = write(fd, &saved, sizeof(saved)) == sizeof(saved);
+
+  for (int y = 0; ok && y < saved.height; ++y) {
+    ok = write(fd, board_row(game->board, y), BOARD_WIDTH) == BOARD_WIDTH;
+  }
+
+  ok = close(fd) == 0 && ok;
+  ok = ok && rename(tmp_path, path) == 0;
+
+  if (!ok) unlink(tmp_path);
+
+  return ok;
+}
+
+
+bool valid_saved_piece(struct Tetromino *saved, struct GameBoard *board)
+{
+  if (saved->type < I_TYPE || saved->type > T_TYPE) return false;
+
+  /* Rebuild the piece of that type and rotation state on an empty board... */
+  struct GameBoard *empty = new_gameboard(board->height, board->width);
+  struct Tetromino t;
+  init_tetromino(&t, saved->type, board->height / 2, board->width / 2, NULL);
+
+  bool ok = saved->num_states == t.num_states
+    && saved->rotation_state >= 0 && saved->rotation_state < t.num_states;
+
+  for (int r = 0; ok && r < saved->rotation_state; ++r) {
+    ok = rotate_tetromino(&t, empty, NULL) == NO_COLLISION;
+  }
+
+  free_gameboard(empty);
+
+  /* ...and it must be the saved one moved somewhere it fits */
+  int dy = saved->center_y - t.center_y, dx = saved->center_x - t.center_x;
+
+  for (int i = 0; ok && i < MAX_BLOCKS; ++i) {
+    ok = saved->square[i].y == t.square[i].y + dy && saved->square[i].x == t.square[i].x + dx
+      && saved->square[i].y >= 0;
+  }
+
+  return ok && check_collision(saved, board) == NO_COLLISION;
+}
+
+
+bool load_game(struct Game *game, struct Difficulty *difficulty, const char *path)
+{
+  struct SavedGame saved;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  bool ok = read(fd, &saved, sizeof(saved)) == sizeof(saved)
+    && memcmp(saved.magic, SAVE_MAGIC, sizeof(saved.magic)) == 0
+    && saved.version == SAVE_VERSION
+    && saved.height >= BOARD_HEIGHT && saved.height <= MAX_BOARD_HEIGHT;
+
+  if (!ok) {
+    close(fd);
+    return false;
+  }
+
+  /* The game keeps the height it was started with, whatever --board-height says now */
+  struct GameBoard *board = new_gameboard(saved.height, BOARD_WIDTH);
+  uint32_t checksum = crc32(0L, (const Bytef *)&saved.height,
+			    sizeof(saved) - offsetof(struct SavedGame, height));
+
+  for (int y = 0; ok && y < saved.height; ++y) {
+    uint8_t *cells = board_row(board, y);
+    ok = read(fd, cells, BOARD_WIDTH) == BOARD_WIDTH;
+    checksum = crc32(checksum, cells, BOARD_WIDTH);
+    for (int x = 0; x < BOARD_WIDTH; ++x) {
+      if (cells[x] > DEAD_TYPE) ok = false;
+      if (cells[x] && board->stack_top == saved.height) board->stack_top = y;
+    }
+  }
+
+  close(fd);
+
+  /*
+   * The checksum only catches accidents: the pieces are checked against the board, the
+   * rules as the flags would be, and the time left before gravity against the speed.
+   */
+  if (!ok || checksum != saved.checksum
+      || !valid_saved_piece(&saved.current, board)
+      || saved.preview.type < I_TYPE || saved.preview.type > T_TYPE
+      || !valid_rules(&saved.difficulty)
+      || !(saved.remaining >= 0. && saved.remaining <= 1. / saved.difficulty.initial_speed)) {
+    free_gameboard(board);
+    return false;
+  }
+
+  game->board = board;
+  game->current = saved.current;
+  recompute_bounding_box(&game->current);
+  init_tetromino(&game->preview, saved.preview.type, PREVIEW_WIN_SIDE / 2 - 1,
+		 PREVIEW_WIN_SIDE / 2, NULL);
+  game->rng = saved.rng;
+  game->threshold = saved.remaining; /* Relative, like a new game's */
+  game->score = saved.score;
+  game->lines = saved.lines;
+  game->pieces = saved.pieces;
+  game->view_top = 0;
+  game->gameover = false;
+
+  *difficulty = saved.difficulty;
+  game->difficulty = difficulty;
+
+  /* A suspended game is resumed once */
+  unlink(path);
+
+  return true;
+}
+
+
+bool saved_game_exists(void)
+{
+  return access(options.save_path, R_OK) == 0;
+}
+
+
+
+/*
+ * Logic Thread
+ */
+
+
+void init_key_queue(struct KeyQueue *q)
+{
+  Die(pthread_mutex_init(&q->lock, NULL) != 0);
+  Die(pthread_cond_init(&q->wakeup, NULL) != 0);
+  q->head = q->tail = 0;
+}
+
+
+void destroy_key_queue(struct KeyQueue *q)
+{
+  pthread_cond_destroy(&q->wakeup);
+  pthread_mutex_destroy(&q->lock);
+}
+
+
+void push_key(struct KeyQueue *q, int ch)
+{
+  pthread_mutex_lock(&q->lock);
+
+  /* A full queue means the logic thread is stuck: further keys would be stale anyway */
+  if (q->tail - q->head < KEY_QUEUE_LEN) {
+    q->keys[q->tail++ % KEY_QUEUE_LEN] = ch;
+    pthread_cond_signal(&q->wakeup);
+  }
+
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+bool pop_key(struct KeyQueue *q, int *ch)
+{
+  pthread_mutex_lock(&q->lock);
+
+  bool popped = q->head != q->tail;
+  if (popped) *ch = q->keys[q->head++ % KEY_QUEUE_LEN];
+
+  pthread_mutex_unlock(&q->lock);
+
+  return popped;
+}
+
+
+void wait_for_keys(struct KeyQueue *q, double timeout)
+{
+  if (timeout <= 0.) return;
+
+  double deadline = get_real_time() + timeout;
+
+  struct timespec ts = {
+    .tv_sec = (time_t)deadline,
+    .tv_nsec = (long)((deadline - (time_t)deadline) * 1e9)
+  };
+
+  pthread_mutex_lock(&q->lock);
+
+  /* Woken early by a key, or by nothing at all: the caller re-checks its clock either way */
+  if (q->head == q->tail) pthread_cond_timedwait(&q->wakeup, &q->lock, &ts);
+
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+void init_triple_buffer(struct TripleBuffer *tb)
+{
+  memset(tb->slots, 0, sizeof(tb->slots));
+  tb->published = 0;
+  tb->back = 0;
+  atomic_init(&tb->middle, 1);
+  tb->front = 2;
+}
+
+
+struct Frame *back_frame(struct TripleBuffer *tb)
+{
+  return &tb->slots[tb->back];
+}
+
+
+void publish_snapshot(struct TripleBuffer *tb)
+{
+  tb->slots[tb->back].seq = ++tb->published;
+
+  int old = atomic_exchange_explicit(&tb->middle, tb->back | FRAME_FRESH, memory_order_acq_rel);
+  tb->back = old & ~FRAME_FRESH;
+}
+
+
+struct Frame *take_snapshot(struct TripleBuffer *tb)
+{
+  if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & FRAME_FRESH)) return NULL;
+
+  int old = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+  tb->front = old & ~FRAME_FRESH;
+
+  return &tb->slots[tb->front];
+}
+
+
+void set_frame_rows(struct Frame *frame, const int *rows, int num_rows)
+{
+  frame->num_rows = 0;
+
+  for (int i = 0; i < num_rows; ++i) {
+    int y = rows[i] - frame->view_top;
+    if (y >= 0 && y < BOARD_HEIGHT) frame->rows[frame->num_rows++] = y;
+  }
+}
+
+
+void fill_frame(struct Frame *frame, struct Game *game, double speed, const int *rows,
+		int num_rows)
+{
+  struct GameBoard *board = game->board;
+
+  /* Boards taller than the screen scroll, to keep the falling piece near the top of it */
+  frame->view_top = Max(0, Min(game->current.min_y - VIEW_MARGIN, board->height - BOARD_HEIGHT));
+
+  for (int y = 0; y < BOARD_HEIGHT; ++y) {
+    memcpy(frame->cells[y], board_row(board, frame->view_top + y), BOARD_WIDTH);
+  }
+
+  for (int i = 0; i < MAX_BLOCKS; ++i) {
+    struct Point p = game->current.square[i];
+    int y = p.y - frame->view_top;
+    if (y >= 0 && y < BOARD_HEIGHT) frame->cells[y][p.x] = game->current.type;
+  }
+
+  /* Cleared rows can only scroll the screen if it still shows the same part of the board */
+  set_frame_rows(frame, rows, frame->view_top == game->view_top ? num_rows : 0);
+  game->view_top = frame->view_top;
+
+  /* The hint is where the spawned piece would land, from wherever it is now */
+  struct Placement placement;
+  frame->pc_chance = options.pc_hint ? pc_lookup(pc_database(), game, &placement) : 0.;
+
+  if (frame->pc_chance > 0.) {
+
+    struct Game target = *game;
+    init_tetromino(&target.current, game->current.type, SPAWN_HEIGHT, SPAWN_WIDTH, NULL);
+    apply_placement(&target, placement);
+
+    for (int i = 0; i < MAX_BLOCKS; ++i) {
+      frame->hint[i] = (struct Point){ .y = target.current.square[i].y - frame->view_top,
+				       .x = target.current.square[i].x };
+    }
+  }
+
+  frame->flashing = false;
+  frame->preview = game->preview.type;
+  frame->score = game->score;
+  frame->speed = speed;
+  frame->gameover = game->gameover;
+}
+
+
+void apply_key(struct Game *game, int ch)
+{
+  if (toupper(ch) == 'W' || ch == KEY_UP) {
+    rotate_tetromino(&game->current, game->board, NULL);
+  } else if (toupper(ch) == 'A' || ch == KEY_LEFT) {
+    move_tetromino(&game->current, game->board, 0, -1, NULL);
+  } else if (toupper(ch) == 'S' || ch == KEY_DOWN) {
+    move_tetromino(&game->current, game->board, +1, 0, NULL);
+  } else if (toupper(ch) == 'D' || ch == KEY_RIGHT) {
+    move_tetromino(&game->current, game->board, 0, +1, NULL);
+  }
+}
+
+
+void *logic_thread(void *arg)
+{
+  struct LogicThread *lt = arg;
+  struct Game *game = &lt->game;
+  struct EventLog *log = lt->session->log;
+  struct TrajectoryWriter *trajectories = lt->session->trajectories;
+  struct Clock *clock = lt->session->clock;
+
+  /* Not the initial speed, when resuming */
+  double speed = speed_from_score(game->difficulty, game->score);
+
+  int num_flashing = 0;		/* Cleared rows still on screen, with --clear-animation */
+  double flash_deadline = 0.;
+
+  int cleared[MAX_BLOCKS];	/* Rows removed since the last published frame */
+  int num_cleared = 0;
+
+  bool changed = true;
+
+  game->threshold += clock->now(clock);
+
+  log_event(log, EV_GAME_START, clock->now(clock), (long)time(NULL));
+  log_event(log, EV_SPAWN, clock->now(clock), (long)game->current.type);
+
+  while (!game->gameover) {
+
+    lt->iterations += 1;
+
+    /* Keys as they came; while cleared rows flash, only a force-quit gets through */
+    int ch;
+    while (pop_key(&lt->keys, &ch)) {
+      if (ch == Ctrl('C')) {
+	game->gameover = true;
+      } else if (ch == SUSPEND_KEY) {
+	/* The next step is a full one after a flash, which would restart it anyway */
+	double remaining = num_flashing > 0 ? 1. / speed : game->threshold - clock->now(clock);
+	lt->suspended = save_game(game, remaining, options.save_path);
+	game->gameover = lt->suspended;
+      } else if (num_flashing == 0) {
+	TraceBegin("input");
+	apply_key(game, ch);
+	TraceEnd("input");
+	changed = true;
+      }
+    }
+
+    double now = clock->now(clock);
+
+    if (game->gameover) {
+      /* Force-quit */
+    } else if (num_flashing > 0) {
+
+      if (now >= flash_deadline) {
+	memcpy(cleared, game->cleared, sizeof(cleared));
+	num_cleared = num_flashing;
+	num_flashing = 0;
+	game->threshold = now + 1. / speed;
+	changed = true;
+      }
+
+    } else if (now >= game->threshold) {
+
+      changed = true;
+
+      if (apply_gravity(game, now, speed, NULL)) {
+
+	log_event(log, EV_LOCK, now, (long)game->current.type,
+		  (long)game->current.rotation_state, (long)game->current.center_y,
+		  (long)game->current.center_x);
+
+	struct Transition step;
+	long score_before = game->score;
+
+	if (trajectories != NULL) begin_transition(game, lt->episode, &step);
+
+	/* The flashing rows are shown as they were, with the piece that completed them */
+	if (options.clear_animation) fill_frame(back_frame(&lt->frames), game, speed, NULL, 0);
+
+	int num_deleted = game_lock_piece(game, NULL, NULL);
+
+	if (trajectories != NULL) {
+	  end_transition(game, score_before, &step);
+	  submit_transitions(trajectories, &step, 1);
+	}
+
+	if (num_deleted > 0) {
+	  log_event(log, EV_ROWS, now, (long)num_deleted);
+	  log_event(log, EV_SCORE, now, score_from_lines(game->difficulty, num_deleted));
+	}
+
+	log_event(log, EV_SPAWN, now, (long)game->current.type);
+
+	if (options.clear_animation && num_deleted > 0 && !game->gameover) {
+	  struct Frame *frame = back_frame(&lt->frames);
+	  set_frame_rows(frame, game->cleared, num_deleted);
+	  frame->flashing = true;
+	  publish_snapshot(&lt->frames);
+
+	  num_flashing = num_deleted;
+	  flash_deadline = now + CLEAR_FLASH_TIME;
+	  changed = false;
+	} else {
+	  memcpy(cleared, game->cleared, sizeof(cleared));
+	  num_cleared = num_deleted;
+	}
+      }
+    }
+
+    double new_speed = speed_from_score(game->difficulty, game->score);
+
+    if (new_speed != speed) {
+      speed = new_speed;
+      log_event(log, EV_SPEED, now, (long)(1000. * speed));
+    }
+
+    if (changed && !game->gameover) {
+      fill_frame(back_frame(&lt->frames), game, speed, cleared, num_cleared);
+      publish_snapshot(&lt->frames);
+
+      num_cleared = 0;
+      changed = false;
+    }
+
+    if (game->gameover) break;
+
+    /* Sleep until the next timed event, unless a key comes first (a virtual clock skips) */
+    double deadline = num_flashing > 0 ? flash_deadline : game->threshold;
+
+    clock->skip_to(clock, deadline);
+    wait_for_keys(&lt->keys, (deadline - clock->now(clock)) / clock->rate);
+  }
+
+  /* The final frame, which also tells the renderer to stop */
+  fill_frame(back_frame(&lt->frames), game, speed, cleared, num_cleared);
+  publish_snapshot(&lt->frames);
+
+  return NULL;
+}
+
+
+bool output_backlogged(void)
+{
+  /*
+   * A terminal device reports its unsent bytes. A pty doesn't, but stops being writable
+   * once whoever reads the other side (sshd, say) falls far enough behind.
+   */
+  int queued = 0;
+  if (ioctl(STDOUT_FILENO, TIOCOUTQ, &queued) == 0 && queued > RENDER_BACKLOG_BYTES) return true;
+
+  struct pollfd out = { .fd = STDOUT_FILENO, .events = POLLOUT };
+  return poll(&out, 1, 0) == 0;
+}
+
+
+
+/*
+ * Versus
+ */
+
+
+void copy_versus_state(struct VersusState *dst, const struct VersusState *src)
+{
+  /* Each state has boards of its own, which only have their cells copied */
+  for (int p = 0; p < 2; ++p) {
+    struct GameBoard *board = dst->player[p].game.board;
+    copy_gameboard(board, src->player[p].game.board);
+
+    dst->player[p] = src->player[p];
+    dst->player[p].game.board = board;
+  }
+
+  dst->frame = src->frame;
+}
+
+
+int step_versus_player(struct VersusPlayer *p, uint8_t input, uint32_t frame)
+{
+  struct Game *game = &p->game;
+
+  if (game->gameover) return 0;
+
+  if (input & VS_RESIGN) {
+    game->gameover = true;
+    p->lost_frame = frame;
+    return 0;
+  }
+
+  /* The keys of the single player game, in a fixed order */
+  if (input & VS_ROTATE) apply_key(game, KEY_UP);
+  if (input & VS_LEFT) apply_key(game, KEY_LEFT);
+  if (input & VS_RIGHT) apply_key(game, KEY_RIGHT);
+  if (input & VS_DOWN) apply_key(game, KEY_DOWN);
+
+  /* Game time is counted in frames, so that both peers see the same gravity steps */
+  double now = (frame + 1.) / VERSUS_TICK_HZ;
+
+  if (!apply_gravity(game, now, speed_from_score(game->difficulty, game->score), NULL)) return 0;
+
+  int lines = game_lock_piece(game, NULL, NULL);
+
+  /* Cleared lines cancel the incoming garbage first, and only the rest is sent */
+  int sent = garbage_from_lines[lines];
+  int cancelled = Min(sent, p->incoming);
+
+  sent -= cancelled;
+  p->incoming -= cancelled;
+
+  if (lines == 0 && p->incoming > 0 && !game->gameover) {
+    int hole = next_random(&p->garbage_rng) % game->board->width;
+    bool fits = add_garbage_rows(game->board, p->incoming, hole);
+
+    game->gameover = !fits || check_collision(&game->current, game->board) != NO_COLLISION;
+    p->incoming = 0;
+  }
+
+  if (game->gameover) p->lost_frame = frame;
+
+  return sent;
+}
+
+
+void step_versus(struct VersusState *state, uint8_t input0, uint8_t input1)
+{
+  int sent0 = step_versus_player(&state->player[0], input0, state->frame);
+  int sent1 = step_versus_player(&state->player[1], input1, state->frame);
+
+  /* Garbage crosses over once both have stepped, so that neither player goes first */
+  state->player[0].incoming += sent1;
+  state->player[1].incoming += sent0;
+
+  state->frame += 1;
+}
+
+
+uint8_t versus_input(struct Versus *vs, int player, uint32_t frame)
+{
+  /* Keys are rare events: the best guess for an input that hasn't arrived is none */
+  if (frame >= vs->num_inputs[player]) return 0;
+
+  return vs->inputs[player][frame % VERSUS_INPUT_WINDOW];
+}
+
+
+void advance_versus(struct Versus *vs)
+{
+  uint32_t frame = vs->state.frame;
+
+  copy_versus_state(&vs->saved[frame % (VERSUS_MAX_ROLLBACK + 1)], &vs->state);
+  step_versus(&vs->state, versus_input(vs, 0, frame), versus_input(vs, 1, frame));
+}
+
+
+void roll_back_versus(struct Versus *vs, uint32_t frame)
+{
+  /*
+   * The frame was stepped with a wrong guess of the peer's input: back to the state
+   * before it, and every frame since then again. No frame is ever more than
+   * VERSUS_MAX_ROLLBACK ahead of the peer's inputs, so that state is still saved.
+   */
+  double start = get_real_time();
+  uint32_t end = vs->state.frame;
+
+  copy_versus_state(&vs->state, &vs->saved[frame % (VERSUS_MAX_ROLLBACK + 1)]);
+
+  while (vs->state.frame < end) advance_versus(vs);
+
+  vs->rollbacks += 1;
+  vs->resimulated += end - frame;
+  vs->max_depth = Max(vs->max_depth, (int)(end - frame));
+  vs->resimulate_time += get_real_time() - start;
+}
+
+
+int open_versus_socket(struct Versus *vs, const char *peer, int port)
+{
+  char host[256];
+  const char *colon = strrchr(peer, ':');
+
+  if (colon == NULL || colon - peer >= sizeof(host)) {
+    fprintf(stderr, "%s: not a HOST:PORT address\n", peer);
+    return -1;
+  }
+
+  memcpy(host, peer, colon - peer);
+  host[colon - peer] = '\0';
+
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM };
+  struct addrinfo *addr;
+
+  int err = getaddrinfo(host, colon + 1, &hints, &addr);
+  if (err != 0) {
+    fprintf(stderr, "%s: %s\n", peer, gai_strerror(err));
+    return -1;
+  }
+
+  memcpy(&vs->peer, addr->ai_addr, addr->ai_addrlen);
+  vs->peer_len = addr->ai_addrlen;
+  freeaddrinfo(addr);
+
+  vs->fd = socket(vs->peer.ss_family, SOCK_DGRAM, 0);
+  Die(vs->fd < 0);
+
+  /* Any local address of the peer's family, on the same port as the peer unless told */
+  struct sockaddr_storage local = { .ss_family = vs->peer.ss_family };
+
+  if (local.ss_family == AF_INET6) {
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&local;
+    in6->sin6_addr = in6addr_any;
+    in6->sin6_port = port > 0 ? htons(port) : ((struct sockaddr_in6 *)&vs->peer)->sin6_port;
+  } else {
+    struct sockaddr_in *in = (struct sockaddr_in *)&local;
+    in->sin_addr.s_addr = htonl(INADDR_ANY);
+    in->sin_port = port > 0 ? htons(port) : ((struct sockaddr_in *)&vs->peer)->sin_port;
+  }
+
+  if (bind(vs->fd, (struct sockaddr *)&local, vs->peer_len) < 0) {
+    fprintf(stderr, "Can't listen on UDP port %d: %s\n", port, strerror(errno));
+    close(vs->fd);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+void send_versus_packet(struct Versus *vs, double now)
+{
+  /* Every input the peer may not have, which is never more than a packet's worth */
+  uint32_t first = Max(vs->peer_ack, vs->num_inputs[0] - Min(vs->num_inputs[0],
+								 VERSUS_PACKET_INPUTS));
+
+  struct DelayedPacket *d;
+
+  /* A full queue loses its oldest packet, whose inputs the next ones repeat anyway */
+  if (vs->delayed_len == VERSUS_DELAY_QUEUE_LEN) {
+    vs->delayed_head = (vs->delayed_head + 1) % VERSUS_DELAY_QUEUE_LEN;
+    vs->delayed_len -= 1;
+  }
+
+  d = &vs->delayed[(vs->delayed_head + vs->delayed_len++) % VERSUS_DELAY_QUEUE_LEN];
+
+  d->due = now + options.latency_ms / 1000.;
+  d->packet.magic = VERSUS_MAGIC;
+  d->packet.nonce = vs->nonce;
+  d->packet.rules = vs->rules;
+  d->packet.ack = vs->num_inputs[1];
+  d->packet.frame = vs->state.frame;
+  d->packet.advantage = vs->advantage;
+  d->packet.first = first;
+  d->packet.count = vs->num_inputs[0] - first;
+
+  for (uint32_t i = 0; i < d->packet.count; ++i) {
+    d->packet.inputs[i] = vs->inputs[0][(first + i) % VERSUS_INPUT_WINDOW];
+  }
+
+  flush_versus_packets(vs, now);
+}
+
+
+void flush_versus_packets(struct Versus *vs, double now)
+{
+  while (vs->delayed_len > 0 && vs->delayed[vs->delayed_head].due <= now) {
+
+    struct VersusPacket *packet = &vs->delayed[vs->delayed_head].packet;
+
+    /* Lost, if the peer isn't there yet: the next packets say it all again */
+    sendto(vs->fd, packet, offsetof(struct VersusPacket, inputs) + packet->count, 0,
+	   (struct sockaddr *)&vs->peer, vs->peer_len);
+
+    vs->delayed_head = (vs->delayed_head + 1) % VERSUS_DELAY_QUEUE_LEN;
+    vs->delayed_len -= 1;
+  }
+}
+
+
+void receive_versus_packets(struct Versus *vs)
+{
+  struct VersusPacket packet;
+  uint32_t mismatch = UINT32_MAX;
+  ssize_t len;
+
+  while ((len = recv(vs->fd, &packet, sizeof(packet), MSG_DONTWAIT)) >= 0) {
+
+    if (len < offsetof(struct VersusPacket, inputs) || packet.magic != VERSUS_MAGIC
+	|| packet.count > VERSUS_PACKET_INPUTS
+	|| len < offsetof(struct VersusPacket, inputs) + packet.count) continue;
+
+    /* Peers on another board height or difficulty would play different games */
+    if (packet.rules != vs->rules) {
+      vs->mismatch = true;
+      continue;
+    }
+
+    if (!vs->connected) start_versus(vs, packet.nonce);
+
+    /* Leftovers of an earlier match, from the same address */
+    if (packet.nonce != vs->peer_nonce) continue;
+
+    vs->peer_ack = Max(vs->peer_ack, packet.ack);
+
+    /* Both see the other one late by the same latency, which cancels out in the difference */
+    vs->advantage = (int32_t)(vs->state.frame - packet.frame);
+    vs->peer_advantage = packet.advantage;
+
+    if (vs->over) continue;
+
+    /* Inputs are taken in order: each packet repeats those that may have been lost */
+    for (uint32_t i = 0; i < packet.count; ++i) {
+
+      uint32_t frame = packet.first + i;
+      if (frame != vs->num_inputs[1]) continue;
+
+      uint8_t input = packet.inputs[i];
+
+      if (frame < vs->state.frame && input != versus_input(vs, 1, frame)) {
+	mismatch = Min(mismatch, frame);
+      }
+
+      vs->inputs[1][frame % VERSUS_INPUT_WINDOW] = input;
+      vs->num_inputs[1] += 1;
+    }
+  }
+
+  if (mismatch != UINT32_MAX) roll_back_versus(vs, mismatch);
+}
+
+
+void start_versus(struct Versus *vs, uint32_t peer_nonce)
+{
+  /* Both halves of the seed are needed, and their order doesn't matter */
+  uint64_t seed = game_seed(vs->nonce ^ peer_nonce, 0);
+
+  for (int p = 0; p < 2; ++p) {
+
+    struct VersusPlayer *player = &vs->state.player[p];
+
+    game_init(&player->game, seed, NULL, NULL);
+    player->garbage_rng = seed;
+    player->incoming = 0;
+    player->lost_frame = -1;
+
+    for (int i = 0; i <= VERSUS_MAX_ROLLBACK; ++i) {
+      vs->saved[i].player[p].game.board = new_gameboard(options.board_height, BOARD_WIDTH);
+    }
+  }
+
+  vs->state.frame = 0;
+  vs->peer_nonce = peer_nonce;
+  vs->connected = true;
+}
+
+
+uint32_t versus_rules(void)
+{
+  const struct Difficulty *d = &options.difficulty;
+  int32_t height = options.board_height;
+  int64_t modulus = d->score_modulus;
+
+  uint32_t crc = crc32(0L, (const Bytef *)&height, sizeof(height));
+  crc = crc32(crc, (const Bytef *)&d->initial_speed, sizeof(d->initial_speed));
+  crc = crc32(crc, (const Bytef *)&d->speed_increment, sizeof(d->speed_increment));
+  crc = crc32(crc, (const Bytef *)&modulus, sizeof(modulus));
+
+  for (int k = 0; k <= MAX_BLOCKS; ++k) {
+    int64_t points = d->line_scores[k];
+    crc = crc32(crc, (const Bytef *)&points, sizeof(points));
+  }
+
+  return crc;
+}
+
+
+uint32_t versus_checksum(struct Game *game)
+{
+  uint32_t crc = crc32(0L, (const Bytef *)&game->score, sizeof(game->score));
+
+  for (int y = 0; y < game->board->height; ++y) {
+    crc = crc32(crc, board_row(game->board, y), game->board->width);
+  }
+
+  return crc;
+}
+
+
+int versus_screen(void)
+{
+  struct Versus *vs = calloc(1, sizeof(*vs));
+  Die(vs == NULL);
+
+  if (open_versus_socket(vs, options.versus_peer, options.versus_port) < 0) {
+    free(vs);
+    return EXIT_FAILURE;
+  }
+
+  vs->nonce = (uint32_t)(get_real_time() * 1e9) ^ (uint32_t)getpid();
+  vs->rules = versus_rules();
+
+  initialize();
+
+  int screen_height, screen_width;
+  getmaxyx(stdscr, screen_height, screen_width);
+
+  /* The game screen's board, preview and stats, once per half of the screen */
+  struct GameWindows wins[2];
+  int board_origin_y = (screen_height - BOARD_HEIGHT) / 2;
+  int board_origin_x[2];
+
+  clear();
+  box(stdscr, ACS_VLINE, ACS_HLINE);
+
+  for (int p = 0; p < 2; ++p) {
+
+    int half = screen_width / 2;
+    board_origin_x[p] = p * half + (half - BOARD_WIDTH - PREVIEW_WIN_SIDE - 4) / 2;
+
+    wins[p].field = NULL;
+    wins[p].board = newwin(BOARD_HEIGHT, BOARD_WIDTH, board_origin_y, board_origin_x[p]);
+    wins[p].preview = newwin(PREVIEW_WIN_SIDE, PREVIEW_WIN_SIDE, board_origin_y,
+			     board_origin_x[p] + BOARD_WIDTH + 4);
+    wins[p].side = newwin(BOARD_HEIGHT - PREVIEW_WIN_SIDE, 12, board_origin_y + PREVIEW_WIN_SIDE,
+			  board_origin_x[p] + BOARD_WIDTH + 3);
+
+    draw_board(stdscr, board_origin_y, board_origin_x[p], BOARD_HEIGHT, BOARD_WIDTH);
+    box(wins[p].preview, ACS_VLINE, ACS_HLINE);
+    mvaddstr(board_origin_y - 2, board_origin_x[p], p == 0 ? "YOU" : "OPPONENT");
+  }
+
+  WINDOW *popup = NULL;
+  double now = get_real_time();
+  double next_tick = now;
+  double over_time = 0.;
+  uint8_t keys = 0;		/* Pressed since the last frame */
+  bool quit = false;
+  bool leaving = false;		/* After the end, once the peer has had the last inputs */
+
+  while (!quit && !(leaving && now >= over_time + VERSUS_LINGER_TIME)) {
+
+    /* Sleep until the next tick or packet due, unless a key or a packet comes first */
+    double deadline = next_tick;
+    if (vs->delayed_len > 0) deadline = Min(deadline, vs->delayed[vs->delayed_head].due);
+
+    struct pollfd fds[2] = { { .fd = STDIN_FILENO, .events = POLLIN },
+			     { .fd = vs->fd, .events = POLLIN } };
+    poll(fds, 2, Max(0, (int)ceil((deadline - now) * 1000.)));
+
+    int ch;
+    while ((ch = getch()) != ERR) {
+
+      if (ch == Ctrl('C')) {
+	quit = true;
+      } else if (!vs->connected || vs->over) {
+	leaving = leaving || toupper(ch) == 'Q';
+      } else if (toupper(ch) == 'Q') {
+	keys |= VS_RESIGN;
+      } else if (toupper(ch) == 'W' || ch == KEY_UP) {
+	keys |= VS_ROTATE;
+      } else if (toupper(ch) == 'A' || ch == KEY_LEFT) {
+	keys |= VS_LEFT;
+      } else if (toupper(ch) == 'S' || ch == KEY_DOWN) {
+	keys |= VS_DOWN;
+      } else if (toupper(ch) == 'D' || ch == KEY_RIGHT) {
+	keys |= VS_RIGHT;
+      }
+    }
+
+    receive_versus_packets(vs);
+
+    now = get_real_time();
+
+    /* Still sent packets for a while, so that the peer finds out too */
+    if (vs->mismatch && !leaving) {
+      leaving = true;
+      over_time = now;
+      popup = draw_message_popup(0, "The opponent plays with another board height or"
+				 " difficulty. Press [Q] to quit.");
+      wrefresh(popup);
+    }
+
+    if (now >= next_tick) {
+
+      next_tick += 1. / VERSUS_TICK_HZ;
+
+      /*
+       * A peer that started later, or runs slow, is let to catch up: until then this side
+       * keeps rolling back. Ahead as far as a rollback can reach, the game has to wait.
+       */
+      if (vs->connected && !vs->over) {
+	if (vs->advantage - vs->peer_advantage >= 2 && vs->state.frame >= vs->next_sync) {
+	  vs->next_sync = vs->state.frame + VERSUS_SYNC_INTERVAL;
+	  vs->syncs += 1;
+	} else if (vs->state.frame < vs->num_inputs[1] + VERSUS_MAX_ROLLBACK) {
+	  vs->inputs[0][vs->num_inputs[0]++ % VERSUS_INPUT_WINDOW] = keys;
+	  keys = 0;
+	  advance_versus(vs);
+	} else {
+	  vs->stalls += 1;
+	}
+      }
+
+      /* Also before the match, to be found, and after, for the peer to see the end */
+      send_versus_packet(vs, now);
+
+      /* The match is over once a loss no longer depends on a guessed input */
+      for (int p = 0; p < 2 && vs->connected && !vs->over; ++p) {
+	int64_t lost = vs->state.player[p].lost_frame;
+	if (lost >= 0 && lost < vs->num_inputs[1]) {
+	  vs->over = true;
+	  over_time = now;
+	}
+      }
+
+      if (popup == NULL) {
+
+	for (int p = 0; p < 2 && vs->connected; ++p) {
+
+	  struct Game *game = &vs->state.player[p].game;
+	  struct Frame frame = { .seq = 0 };
+
+	  fill_frame(&frame, game, speed_from_score(game->difficulty, game->score), NULL, 0);
+	  draw_frame(&frame, 0, wins[p].board, wins[p].preview, wins[p].side);
+
+	  char incoming[16] = "";
+	  if (vs->state.player[p].incoming > 0) {
+	    snprintf(incoming, sizeof(incoming), "+%d GARBAGE", vs->state.player[p].incoming);
+	  }
+	  mvprintw(board_origin_y + BOARD_HEIGHT + 2, board_origin_x[p], "%-12s", incoming);
+	}
+
+	move(screen_height - 2, 2);
+	clrtoeol();
+
+	if (vs->connected) {
+	  printw("Frame %u, %ld rollbacks (at most %d frames), %ld stalls, %ld syncs",
+		 vs->state.frame, vs->rollbacks, vs->max_depth, vs->stalls, vs->syncs);
+	} else {
+	  printw("Waiting for %s...", options.versus_peer);
+	}
+
+	box(stdscr, ACS_VLINE, ACS_HLINE);
+	wnoutrefresh(stdscr);
+
+	for (int p = 0; p < 2; ++p) {
+	  wnoutrefresh(wins[p].side);
+	  wnoutrefresh(wins[p].preview);
+	  wnoutrefresh(wins[p].board);
+	}
+
+	doupdate();
+      }
+
+      if (vs->over && popup == NULL) {
+
+	int64_t lost0 = vs->state.player[0].lost_frame;
+	int64_t lost1 = vs->state.player[1].lost_frame;
+
+	if (lost0 < 0) lost0 = INT64_MAX;
+	if (lost1 < 0) lost1 = INT64_MAX;
+
+	popup = draw_message_popup(0, lost0 == lost1 ? "Draw. Press [Q] to quit."
+				   : lost0 < lost1 ? "You lose. Press [Q] to quit."
+				   : "You win! Press [Q] to quit.");
+	wrefresh(popup);
+      }
+    }
+
+    flush_versus_packets(vs, now);
+  }
+
+  if (popup != NULL) delwin(popup);
+
+  for (int p = 0; p < 2; ++p) {
+    delwin(wins[p].side);
+    delwin(wins[p].preview);
+    delwin(wins[p].board);
+  }
+
+  endwin();
+
+  if (vs->connected) {
+    printf("%u frames, %ld rollbacks, %ld frames stepped again (at most %d at once,"
+	   " %.1f us each), %ld stalls, %ld syncs\n", vs->state.frame, vs->rollbacks,
+	   vs->resimulated, vs->max_depth,
+	   vs->resimulated > 0 ? 1e6 * vs->resimulate_time / vs->resimulated : 0., vs->stalls,
+	   vs->syncs);
+    printf("Final boards: you %08x, opponent %08x\n",
+	   versus_checksum(&vs->state.player[0].game), versus_checksum(&vs->state.player[1].game));
+
+    for (int p = 0; p < 2; ++p) {
+      free_gameboard(vs->state.player[p].game.board);
+      for (int i = 0; i <= VERSUS_MAX_ROLLBACK; ++i) free_gameboard(vs->saved[i].player[p].game.board);
+    }
+  }
+
+  if (vs->mismatch) {
+    fprintf(stderr, "%s: plays with another --board-height or difficulty\n",
+	    options.versus_peer);
+  }
+
+  bool mismatch = vs->mismatch;
+
+  close(vs->fd);
+  free(vs);
+
+  return mismatch ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+
+/*
+ * Render Benchmark
+ */
+
+
+void *bench_drain_thread(void *arg)
+{
+  struct RenderBench *rb = arg;
+  unsigned char buf[4096];
+  ssize_t n;
+
+  /* Until the terminal side is closed (EIO) */
+  while ((n = read(rb->master, buf, sizeof(buf))) > 0) {
+
+    pthread_mutex_lock(&rb->lock);
+
+    for (ssize_t i = 0; i < n; ++i) {
+      if (buf[i] == BENCH_MARKER) {
+	rb->markers += 1;
+	pthread_cond_signal(&rb->seen);
+      } else {
+	rb->bytes += 1;
+	rb->escapes += buf[i] == '\033';
+      }
+    }
+
+    pthread_mutex_unlock(&rb->lock);
+  }
+
+  return NULL;
+}
+
+
+void open_render_bench(struct RenderBench *rb)
+{
+  /* Raw output, so the bytes counted are exactly those ncurses sent */
+  struct termios tio;
+  memset(&tio, 0, sizeof(tio));
+  cfmakeraw(&tio);
+
+  struct winsize size = { .ws_row = BENCH_ROWS, .ws_col = BENCH_COLS };
+
+  Die(openpty(&rb->master, &rb->slave, NULL, &tio, &size) < 0);
+
+  rb->bytes = rb->escapes = rb->markers = 0;
+
+  Die(pthread_mutex_init(&rb->lock, NULL) != 0);
+  Die(pthread_cond_init(&rb->seen, NULL) != 0);
+  Die(pthread_create(&rb->drain, NULL, bench_drain_thread, rb) != 0);
+
+  rb->out = fdopen(rb->slave, "w");
+  rb->in = fdopen(dup(rb->slave), "r");
+  Die(rb->out == NULL || rb->in == NULL);
+
+  use_env(false);		/* The pty size, whatever LINES and COLUMNS say */
+
+  char *term = getenv("TERM");
+  rb->term = term != NULL && *term != '\0' ? term : "xterm";
+
+  rb->screen = newterm(rb->term, rb->out, rb->in);
+  Die(rb->screen == NULL);
+
+  raw();
+  noecho();
+  curs_set(0);
+  init_colors();
+}
+
+
+void close_render_bench(struct RenderBench *rb)
+{
+  endwin();
+  delscreen(rb->screen);
+  fclose(rb->out);
+  fclose(rb->in);
+
+  pthread_join(rb->drain, NULL);
+  close(rb->master);
+
+  pthread_cond_destroy(&rb->seen);
+  pthread_mutex_destroy(&rb->lock);
+}
+
+
+void bench_frame(struct RenderBench *rb, struct GameWindows *wins, struct Frame *frame,
+		 uint64_t *drawn_seq, struct BenchResult *result)
+{
+  frame->seq = *drawn_seq + 1;
+  draw_frame(frame, *drawn_seq, wins->board, wins->preview, wins->side);
+  *drawn_seq = frame->seq;
+
+  double start = get_real_time();
+  refresh_game_windows(wins);
+  double elapsed = get_real_time() - start;
+
+  /* The marker follows the frame through the pty: once it's read, so is the whole frame */
+  const unsigned char marker = BENCH_MARKER;
+  write_all(rb->slave, &marker, 1);
+
+  pthread_mutex_lock(&rb->lock);
+
+  long expected = ++rb->sent;
+  while (rb->markers < expected) pthread_cond_wait(&rb->seen, &rb->lock);
+
+  long bytes = rb->bytes, escapes = rb->escapes;
+  rb->bytes = rb->escapes = 0;
+
+  pthread_mutex_unlock(&rb->lock);
+
+  if (result == NULL) return;	/* Setup, not measured */
+
+  result->frames += 1;
+  result->bytes += bytes;
+  result->escapes += escapes;
+  result->update_time += elapsed;
+  if (bytes > result->max_bytes) result->max_bytes = bytes;
+}
+
+
+void run_bench_scenario(struct RenderBench *rb, enum BenchScenario scenario, uint64_t seed,
+			struct BenchResult *result)
+{
+  struct GameWindows wins;
+  open_game_windows(&wins);
+
+  struct Game game;
+  game_init(&game, seed, NULL, NULL);
+
+  struct Frame frame;
+  uint64_t drawn_seq = 0;
+
+  if (scenario == BENCH_TETRIS) {
+
+    /* Four rows full but for the first column, and an I piece (spawned upright) above it */
+    for (int y = game.board->height - 4; y < game.board->height; ++y) {
+      for (int x = 1; x < BOARD_WIDTH; ++x) board_row(game.board, y)[x] = 1 + (x + y) % MAX_TYPES;
+    }
+    game.board->stack_top = game.board->height - 4;
+
+    init_tetromino(&game.current, I_TYPE, SPAWN_HEIGHT, SPAWN_WIDTH, NULL);
+    while (move_tetromino(&game.current, game.board, 0, -1, NULL) == NO_COLLISION);
+
+  } else if (scenario == BENCH_COLLAPSE) {
+
+    /* A ragged stack up to a few rows below the spawn, with a well in column 0 */
+    for (int y = VIEW_MARGIN + 4; y < game.board->height; ++y) {
+      for (int x = 0; x < BOARD_WIDTH; ++x) {
+	bool full = x != 0 && (y == game.board->height - 1 || (x + 3 * y) % 4 != 0);
+	board_row(game.board, y)[x] = full ? 1 + (x + y) % MAX_TYPES : 0;
+      }
+    }
+    game.board->stack_top = VIEW_MARGIN + 4;
+
+    /* An upright I piece drops down the well, and completes the bottom row only */
+    init_tetromino(&game.current, I_TYPE, SPAWN_HEIGHT, SPAWN_WIDTH, NULL);
+    while (move_tetromino(&game.current, game.board, 0, -1, NULL) == NO_COLLISION);
+  }
+
+  /* The first paint of the game screen is a scenario of its own */
+  fill_frame(&frame, &game, game.difficulty->initial_speed, NULL, 0);
+  bench_frame(rb, &wins, &frame, &drawn_seq, scenario == BENCH_REDRAW ? result : NULL);
+
+  if (scenario == BENCH_FALL) {
+
+    /* Pieces falling one row per frame, locking and piling up */
+    for (int i = 0; i < BENCH_FRAMES && !game.gameover; ++i) {
+
+      int num_deleted = 0;
+      if (move_tetromino(&game.current, game.board, +1, 0, NULL) != NO_COLLISION) {
+	num_deleted = game_lock_piece(&game, NULL, NULL);
+      }
+
+      fill_frame(&frame, &game, game.difficulty->initial_speed, game.cleared, num_deleted);
+      bench_frame(rb, &wins, &frame, &drawn_seq, result);
+    }
+
+  } else if (scenario == BENCH_ROTATE) {
+
+    move_tetromino(&game.current, game.board, +2, 0, NULL);
+
+    for (int i = 0; i < BENCH_FRAMES; ++i) {
+      rotate_tetromino(&game.current, game.board, NULL);
+      fill_frame(&frame, &game, game.difficulty->initial_speed, NULL, 0);
+      bench_frame(rb, &wins, &frame, &drawn_seq, result);
+    }
+
+  } else if (scenario == BENCH_TETRIS) {
+
+    /* The I piece drops into its well, then the four rows collapse at once */
+    while (move_tetromino(&game.current, game.board, +1, 0, NULL) == NO_COLLISION) {
+      fill_frame(&frame, &game, game.difficulty->initial_speed, NULL, 0);
+      bench_frame(rb, &wins, &frame, &drawn_seq, NULL);
+    }
+
+    int num_deleted = game_lock_piece(&game, NULL, NULL);
+
+    fill_frame(&frame, &game, speed_from_score(game.difficulty, game.score), game.cleared,
+	       num_deleted);
+    bench_frame(rb, &wins, &frame, &drawn_seq, result);
+
+  } else if (scenario == BENCH_COLLAPSE) {
+
+    /* Down the well, to the bottom */
+    while (move_tetromino(&game.current, game.board, +1, 0, NULL) == NO_COLLISION) {
+      fill_frame(&frame, &game, game.difficulty->initial_speed, NULL, 0);
+      bench_frame(rb, &wins, &frame, &drawn_seq, NULL);
+    }
+
+    int num_deleted = game_lock_piece(&game, NULL, NULL);
+
+    fill_frame(&frame, &game, speed_from_score(game.difficulty, game.score), game.cleared,
+	       num_deleted);
+    bench_frame(rb, &wins, &frame, &drawn_seq, result);
+
+  } else if (scenario == BENCH_STATS) {
+
+    for (int i = 0; i < BENCH_FRAMES; ++i) {
+      game.score += score_from_lines(game.difficulty, 1 + i % 4);
+      fill_frame(&frame, &game, speed_from_score(game.difficulty, game.score), NULL, 0);
+      bench_frame(rb, &wins, &frame, &drawn_seq, result);
+    }
+  }
+
+  free_gameboard(game.board);
+  close_game_windows(&wins);
+
+  /* Back to a blank screen, so every run starts from the same terminal state */
+  clear();
+  refresh();
+}
+
+
+int render_bench(void)
+{
+  const char *scenario_name[NUM_BENCH_SCENARIOS] = {
+    [BENCH_REDRAW] = "redraw",
+    [BENCH_FALL] = "fall",
+    [BENCH_ROTATE] = "rotate",
+    [BENCH_TETRIS] = "tetris",
+    [BENCH_COLLAPSE] = "collapse",
+    [BENCH_STATS] = "stats"
+  };
+
+  struct BenchResult results[NUM_BENCH_SCENARIOS] = { 0 };
+
+  struct RenderBench rb = { 0 };
+  open_render_bench(&rb);
+
+  for (int run = 0; run < options.games; ++run) {
+    for (int s = 0; s < NUM_BENCH_SCENARIOS; ++s) {
+      run_bench_scenario(&rb, s, game_seed(options.seed, run), &results[s]);
+    }
+  }
+
+  close_render_bench(&rb);
+
+  printf("%s, %dx%d, %d runs per scenario\n\n", rb.term, BENCH_COLS, BENCH_ROWS, options.games);
+  printf("%-8s %8s %12s %10s %14s %14s\n", "scenario", "frames", "bytes/frame", "max bytes",
+	 "escapes/frame", "doupdate us");
+
+  for (int s = 0; s < NUM_BENCH_SCENARIOS; ++s) {
+
+    struct BenchResult *r = &results[s];
+    if (r->frames == 0) continue;
+
+    printf("%-8s %8ld %12.1f %10ld %14.1f %14.1f\n", scenario_name[s], r->frames,
+	   (double)r->bytes / r->frames, r->max_bytes, (double)r->escapes / r->frames,
+	   1e6 * r->update_time / r->frames);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+
+
+/*
+ * Resource Accounting
+ */
+
+
+void read_usage(struct PhaseUsage *u)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+
+  u->wall_time = get_real_time();
+  u->cpu_time = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+    + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+  u->wakeups = ru.ru_nvcsw + ru.ru_nivcsw;
+  u->peak_rss_kb = ru.ru_maxrss;
+
+  /*
+   * ncurses write()s straight to the terminal, bypassing stdio, so the count is the
+   * kernel's. Only this thread's: it does all the drawing, while logs, dumps and saves
+   * are written by threads of their own.
+   */
+  u->bytes_written = 0;
+
+  FILE *io = fopen("/proc/thread-self/io", "r");
+  if (io == NULL) return;
+
+  char line[128];
+  while (fgets(line, sizeof(line), io) != NULL
+	 && sscanf(line, "wchar: %ld", &u->bytes_written) != 1);
+
+  fclose(io);
+}
+
+
+void begin_phase(enum Phase phase)
+{
+  accounting.phase = phase;
+  memset(&accounting.running, 0, sizeof(accounting.running));
+
+  read_usage(&accounting.start);
+}
+
+
+void end_phase(void)
+{
+  struct PhaseUsage now, *u = &accounting.running;
+  read_usage(&now);
+
+  u->visits = 1;
+  u->wall_time = now.wall_time - accounting.start.wall_time;
+  u->cpu_time = now.cpu_time - accounting.start.cpu_time;
+  u->wakeups = now.wakeups - accounting.start.wakeups;
+  u->bytes_written = now.bytes_written - accounting.start.bytes_written;
+  u->peak_rss_kb = now.peak_rss_kb;
+
+  struct PhaseUsage *total = &accounting.phases[accounting.phase];
+
+  total->visits += u->visits;
+  total->wall_time += u->wall_time;
+  total->cpu_time += u->cpu_time;
+  total->wakeups += u->wakeups;
+  total->iterations += u->iterations;
+  total->idle_polls += u->idle_polls;
+  total->frames += u->frames;
+  total->bytes_written += u->bytes_written;
+  total->peak_rss_kb = Max(total->peak_rss_kb, u->peak_rss_kb);
+
+  if (accounting.phase != PHASE_GAME) return;
+
+  if (accounting.num_games == accounting.cap_games) {
+    accounting.cap_games = Max(2 * accounting.cap_games, 16);
+    accounting.games = realloc(accounting.games, accounting.cap_games * sizeof(*u));
+    Die(accounting.games == NULL);
+  }
+
+  accounting.games[accounting.num_games++] = *u;
+}
+
+
+int read_key(void)
+{
+  int ch = getch();
+  if (ch == ERR) accounting.running.idle_polls += 1;
+
+  return ch;
+}
+
+
+void print_usage_line(FILE *out, const char *name, const struct PhaseUsage *u)
+{
+  fprintf(out, "%-10s %6d %9.2fs %8.3fs %5.1f%% %9ld %11ld %10ld %8ld %11ld %8ldk\n", name,
+	  u->visits, u->wall_time, u->cpu_time,
+	  u->wall_time > 0. ? 100. * u->cpu_time / u->wall_time : 0., u->wakeups,
+	  u->iterations, u->idle_polls, u->frames, u->bytes_written, u->peak_rss_kb);
+}
+
+
+void write_usage_report(void)
+{
+  if (!options.usage_report) return;
+
+  FILE *out = options.usage_report_path != NULL ? fopen(options.usage_report_path, "w") : stderr;
+
+  if (out == NULL) {
+    perror(options.usage_report_path);
+    return;
+  }
+
+  fprintf(out, "%-10s %6s %10s %9s %6s %9s %11s %10s %8s %11s %9s\n", "phase", "visits",
+	  "wall", "cpu", "cpu", "wakeups", "iterations", "idle polls", "frames", "bytes out",
+	  "peak RSS");
+
+  for (int g = 0; g < accounting.num_games; ++g) {
+    char name[32];
+    snprintf(name, sizeof(name), "game %d", g + 1);
+    print_usage_line(out, name, &accounting.games[g]);
+  }
+
+  if (accounting.num_games > 0) fputc('\n', out);
+
+  for (int p = 0; p < NUM_PHASES; ++p) print_usage_line(out, phase_names[p], &accounting.phases[p]);
+
+  if (out != stderr) fclose(out);
+
+  free(accounting.games);
+}
+
+
+/* 
+ * Graphics
+ */
+
+
+void draw_tetromino(WINDOW *win, struct Tetromino * const t, int offset_y, int offset_x)
+{
+  wcolor_set(win, t->type, NULL);
+  for (int i = 0; i < MAX_BLOCKS; ++i) { 
+    mvwaddch(win, offset_y + t->square[i].y, offset_x + t->square[i].x, ACS_DIAMOND);
+  }  
+}
+
+
+void delete_tetromino(WINDOW *win, struct Tetromino * const t, int offset_y, int offset_x)
+{
+  wcolor_set(win, 0, NULL);
+  for (int i = 0; i < MAX_BLOCKS; ++i) {
+    mvwaddch(win, offset_y + t->square[i].y, offset_x + t->square[i].x, ' ');
+  }
+}
+
+void draw_board(WINDOW *win, int top_left_y, int top_left_x, int height, int width)
+{
+  /* Basic line */
+  mvwvline(win, top_left_y, top_left_x - 1, ACS_VLINE, height);
+  mvwvline(win, top_left_y, top_left_x + width, ACS_VLINE, height);
+  mvwhline(win, top_left_y + height, top_left_x, ACS_HLINE, width);
+  mvwaddch(win, top_left_y + height, top_left_x - 1, ACS_LLCORNER);
+  mvwaddch(win, top_left_y + height, top_left_x + width, ACS_LRCORNER);
+  
+  /* Walls */
+  mvwvline(win, top_left_y, top_left_x - 2, ACS_CKBOARD, height + 1);
+  mvwvline(win, top_left_y, top_left_x + width + 1, ACS_CKBOARD, height + 1);
+  mvwhline(win, top_left_y + height + 1, top_left_x - 2, ACS_CKBOARD, width + 4);
+}
+
+
+void animate_clear(WINDOW *win, const int *rows, int num_rows)
+{
+  int height = getmaxy(win);
+
+  /*
+   * Each run of adjacent cleared rows becomes a single scroll of the region above its
+   * bottom. Runs are taken from the top down, so the lower ones haven't moved yet.
+   * This only moves the window's contents, so that draw_frame finds those rows already
+   * in place. What reaches the terminal is up to doupdate, which sets a scroll region
+   * (or inserts and deletes lines) wherever whole screen lines have moved: the lines
+   * that hold the speed readout beside the stack are repainted instead.
+   */
+  idlok(win, true);
+  scrollok(win, true);
+
+  for (int i = num_rows - 1; i >= 0; ) {
+
+    int top = rows[i];
+    int bottom = top;
+
+    for (--i; i >= 0 && rows[i] == bottom + 1; --i) bottom = rows[i];
+
+    if (top == 0) {		/* Nothing above to drop: the region is just blanked */
+      for (int y = 0; y <= bottom; ++y) {
+	wmove(win, y, 0);
+	wclrtoeol(win);
+      }
+    } else {
+      wsetscrreg(win, 0, bottom);
+      wscrl(win, -(bottom - top + 1));
+    }
+  }
+
+  wsetscrreg(win, 0, height - 1);
+  scrollok(win, false);		/* Or a block in the bottom-right corner would scroll */
 }
 
 
-enum GameState score_screen(struct Ranking rankings[MAX_RANKINGS + 1])
+void highlight_rows(WINDOW *win, const int *rows, int num_rows)
 {
-  clear();
+  for (int i = 0; i < num_rows; ++i) mvwchgat(win, rows[i], 0, -1, A_REVERSE, DEAD_TYPE, NULL);
+}
+
+
+void draw_updated_stats(WINDOW *win, long score, double speed)
+{
+  TraceBegin("draw_updated_stats");
+
+  int height, width;
+  getmaxyx(win, height, width);
   
+  char score_str[11];
+  snprintf(score_str, 11, "%010ld", score);
+
+  mvwaddstr(win, height / 3 - 1, (width - strlen(score_str)) / 2, "SCORE:");
+  mvwaddstr(win, height / 3, (width - strlen(score_str)) / 2, score_str);
+
+  char speed_str[11];
+  snprintf(speed_str, 11, "%.2gx", speed);
+
+  mvwaddstr(win, 2 * height / 3 - 1, (width - strlen(score_str)) / 2, "SPEED:");
+  mvwaddstr(win, 2 * height / 3, (width - strlen(score_str)) / 2, speed_str);
+
+  TraceEnd("draw_updated_stats");
+}
+
+
+void open_game_windows(struct GameWindows *wins)
+{
   int screen_height, screen_width;
   getmaxyx(stdscr, screen_height, screen_width);
+
+  int field_height = screen_height;
+  int field_width = 2 * screen_width / 3;
   
-  char *score_str = "TOP-10 RANKINGS";
-  mvprintw(screen_height / 4, (screen_width - strlen(score_str)) / 2, score_str);
+  wins->field = newwin(field_height, field_width, 0, 0);
+
+  wins->side = newwin(screen_height, screen_width - field_width, 0, field_width);
+  
+  int board_origin_y = (field_height - BOARD_HEIGHT) / 2;
+  int board_origin_x = (field_width - BOARD_WIDTH) / 2;
+
+  wins->board = newwin(BOARD_HEIGHT, BOARD_WIDTH, board_origin_y, board_origin_x);
+
+  wins->preview = newwin(PREVIEW_WIN_SIDE, PREVIEW_WIN_SIDE,
+			 board_origin_y,
+			 board_origin_x + BOARD_WIDTH + 4);
   
-  for (int i = 0; i < MAX_RANKINGS; ++i) {
-    mvprintw(screen_height / 4 + 2 + i, (screen_width - 15) / 2, "%s  %010ld",
-	     rankings[i].name, rankings[i].score);
+  /* Add the basic graphical decorations */
+  draw_board(wins->field, board_origin_y, board_origin_x, BOARD_HEIGHT, BOARD_WIDTH);
+  box(wins->field, ACS_VLINE, ACS_HLINE);
+  box(wins->side, ACS_VLINE, ACS_HLINE);
+  box(wins->preview, ACS_VLINE, ACS_HLINE);
+}
+
+
+void refresh_game_windows(struct GameWindows *wins)
+{
+  /* Refresh all screen assets */
+  wnoutrefresh(wins->field);
+  wnoutrefresh(wins->side);
+  wnoutrefresh(wins->preview);
+  wnoutrefresh(wins->board);
+
+  TraceBegin("doupdate");
+  doupdate();
+  TraceEnd("doupdate");
+}
+
+
+void close_game_windows(struct GameWindows *wins)
+{
+  delwin(wins->board);
+  delwin(wins->preview);
+  delwin(wins->side);
+  delwin(wins->field);
+}
+
+
+void draw_frame(struct Frame *frame, uint64_t drawn_seq, WINDOW *board_win, WINDOW *preview_win,
+		WINDOW *side_win)
+{
+  /* Rows cleared right after the frame on screen can still scroll; otherwise just repaint */
+  if (!frame->flashing && frame->seq == drawn_seq + 1) {
+    animate_clear(board_win, frame->rows, frame->num_rows);
+  }
+
+  /* Only the cells that differ from the window: after a scroll, most of them don't */
+  for (int y = 0; y < BOARD_HEIGHT; ++y) {
+    for (int x = 0; x < BOARD_WIDTH; ++x) {
+      int type = frame->cells[y][x];
+      chtype cell = (type ? ACS_DIAMOND : ' ') | COLOR_PAIR(type);
+      if (mvwinch(board_win, y, x) == cell) continue;
+      wcolor_set(board_win, type, NULL);
+      mvwaddch(board_win, y, x, type ? ACS_DIAMOND : ' ');
+    }
+  }
+
+  if (frame->flashing) highlight_rows(board_win, frame->rows, frame->num_rows);
+
+  /* Marked on the cells it would take that are still free */
+  if (frame->pc_chance > 0.) {
+    wcolor_set(board_win, 0, NULL);
+    for (int i = 0; i < MAX_BLOCKS; ++i) {
+      struct Point p = frame->hint[i];
+      if (p.y >= 0 && p.y < BOARD_HEIGHT && !frame->cells[p.y][p.x]) {
+	mvwaddch(board_win, p.y, p.x, '+');
+      }
+    }
+  }
+
+  /* Only the inside of the preview box, which keeps its border */
+  wcolor_set(preview_win, 0, NULL);
+  for (int y = 1; y < PREVIEW_WIN_SIDE - 1; ++y) {
+    mvwhline(preview_win, y, 1, ' ', PREVIEW_WIN_SIDE - 2);
+  }
+
+  struct Tetromino preview;
+  init_tetromino(&preview, frame->preview, PREVIEW_WIN_SIDE / 2 - 1, PREVIEW_WIN_SIDE / 2,
+		 preview_win);
+
+  draw_updated_stats(side_win, frame->score, frame->speed);
+
+  if (options.pc_hint) {
+
+    int height, width;
+    getmaxyx(side_win, height, width);
+
+    char chance_str[11];
+    snprintf(chance_str, 11, frame->pc_chance > 0. ? "%.0f%%" : "-", 100. * frame->pc_chance);
+
+    mvwaddstr(side_win, 5 * height / 6 - 1, (width - 10) / 2, "PC CHANCE:");
+    mvwprintw(side_win, 5 * height / 6, (width - 10) / 2, "%-10s", chance_str);
   }
+}
+
+
+WINDOW *draw_message_popup(int col_offt, char *msg)
+{
+  int screen_height, screen_width;
+  getmaxyx(stdscr, screen_height, screen_width);
+  
+  WINDOW *win = newwin(5, strlen(msg) + 4,
+		       (screen_height) / 2 - 2 + col_offt,
+		       (screen_width - strlen(msg)) / 2);
+  
+  box(win, ACS_VLINE, ACS_HLINE);
+
+  mvwaddnstr(win, 2, 2, msg, strlen(msg));
+  
+  return win;
+}
 
-  char *msg_string = "Press [T] to go back to the Title Screen or [Q] to quit.";
-  mvprintw(screen_height / 4 + 13, (screen_width - strlen(msg_string)) / 2, msg_string);
 
+/* 
+ * Game Phases
+ */
+
+
+enum GameState title_screen(void)
+{
+  clear();
+    
+  int screen_height, screen_width;
+  getmaxyx(stdscr, screen_height, screen_width);
+
+  for (int i = 0; i < TITLE_HEIGHT; ++i)
+    mvprintw(screen_height / 3 + i, (screen_width - TITLE_WIDTH) / 2, title_string[i]);
   
+  bool can_resume = saved_game_exists();
+
+  char *welcome_string = can_resume
+    ? "Press [RET] to play, [R] to resume, [S] for the rankings, or [Q] to quit."
+    : "Press [RET] to play, [S] to display the rankings, or [Q] to quit.";
+  mvprintw(screen_height * 2 / 3, (screen_width - strlen(welcome_string)) / 2, welcome_string);
+
   box(stdscr, ACS_VLINE, ACS_HLINE);
     
-  refresh();
+  wrefresh(stdscr);
 
   enum GameState next_state;
   
+  accounting.running.frames += 1;
+
   while (true) {
-    chtype ch = getch();
-    if (toupper(ch) == 'T') {
-      next_state = STATE_TITLE;
+    accounting.running.iterations += 1;
+    chtype ch = read_key();
+    if (ch == KEY_RETURN) {
+      next_state = STATE_GAME;
+      break;
+    } else if (can_resume && toupper(ch) == 'R') {
+      next_state = STATE_RESUME;
+      break;
+    } else if (toupper(ch) == 'S') {
+      next_state = STATE_SCORES;
       break;
     } else if (toupper(ch) == 'Q') {
       next_state = STATE_QUIT;
@@ -526,18 +5396,102 @@ enum GameState score_screen(struct Ranking rankings[MAX_RANKINGS + 1])
 }
 
 
-enum GameState manage_gameover(void)
+enum GameState score_screen(struct Leaderboard *leaderboard, struct ScoreIndex *scores)
+{
+  int screen_height, screen_width;
+  getmaxyx(stdscr, screen_height, screen_width);
+
+  /* Page 0 is the top-10; with a score index, every game ever played follows */
+  long page = 0;
+  long total = score_index_count(scores);
+  long num_pages = 1 + (total + SCORE_PAGE_LEN - 1) / SCORE_PAGE_LEN;
+
+  enum GameState next_state = STATE_SCORES;
+  
+  while (next_state == STATE_SCORES) {
+
+    clear();
+
+    if (page == 0) {
+
+      struct Ranking rankings[MAX_RANKINGS];
+      read_rankings(leaderboard, rankings);
+
+      char *score_str = "TOP-10 RANKINGS";
+      mvprintw(screen_height / 4, (screen_width - strlen(score_str)) / 2, score_str);
+  
+      for (int i = 0; i < MAX_RANKINGS; ++i) {
+	mvprintw(screen_height / 4 + 2 + i, (screen_width - 15) / 2, "%s  %010ld",
+		 rankings[i].name, rankings[i].score);
+      }
+
+    } else {
+
+      struct ScoreNode entries[SCORE_PAGE_LEN];
+      long first = (page - 1) * SCORE_PAGE_LEN;
+      int n = score_index_page(scores, first, SCORE_PAGE_LEN, entries, &total);
+
+      mvprintw(screen_height / 4, (screen_width - 36) / 2, "ALL %8ld GAMES, PAGE %5ld OF %-5ld",
+	       total, page, num_pages - 1);
+
+      for (int i = 0; i < n; ++i) {
+	mvprintw(screen_height / 4 + 2 + i, (screen_width - 36) / 2, "%10ld  %-12.12s  %010ld",
+		 first + i + 1, entries[i].name, entries[i].score);
+      }
+    }
+
+    char *msg_string = num_pages > 1
+      ? "Press [N]/[P] for more pages, [T] for the Title Screen or [Q] to quit."
+      : "Press [T] to go back to the Title Screen or [Q] to quit.";
+    mvprintw(screen_height / 4 + 13, (screen_width - strlen(msg_string)) / 2, msg_string);
+
+    box(stdscr, ACS_VLINE, ACS_HLINE);
+    
+    refresh();
+    accounting.running.frames += 1;
+
+    while (true) {
+      accounting.running.iterations += 1;
+      chtype ch = read_key();
+      if (toupper(ch) == 'T') {
+	next_state = STATE_TITLE;
+	break;
+      } else if (toupper(ch) == 'Q') {
+	next_state = STATE_QUIT;
+	break;
+      } else if (toupper(ch) == 'N' && page + 1 < num_pages) {
+	page += 1;
+	break;
+      } else if (toupper(ch) == 'P' && page > 0) {
+	page -= 1;
+	break;
+      }
+    }
+  }
+
+  return next_state;
+}
+
+
+enum GameState manage_gameover(long rank, long total)
 {
-  char msg[] = "Game Over. Press [T] to go to the title screen or [Q] to quit.";
+  char msg[128] = "Game Over. Press [T] to go to the title screen or [Q] to quit.";
+
+  if (rank > 0) {
+    snprintf(msg, sizeof(msg), "Game Over, #%ld of %ld. Press [T] for the title screen or [Q] to quit.",
+	     rank, total);
+  }
 
   WINDOW *popup_win = draw_message_popup(0, msg);
 
   wrefresh(popup_win);
+  accounting.running.frames += 1;
   
   enum GameState next_state;
 
   while (true) {
-    chtype ch = getch();
+    accounting.running.iterations += 1;
+    chtype ch = read_key();
     if (toupper(ch) == 'T') {
       next_state = STATE_TITLE;
       break;
@@ -553,13 +5507,6 @@ enum GameState manage_gameover(void)
 }
 
 
-/* Comparison function for qsort */
-bool ranking_ge(struct Ranking *a, struct Ranking *b)
-{
-  return a->score < b->score;
-}
-
-
 void insert_ranking_name(char *name)
 {
   /* Display message and create box window to insert the initials */
@@ -597,11 +5544,14 @@ void insert_ranking_name(char *name)
     wnoutrefresh(msg_win);
     wrefresh(insert_box);
 
+    accounting.running.iterations += 1;
+    accounting.running.frames += 1;
+
     wmove(insert_box, 3, i + 4);
     
     chtype ch;
 
-    if ((ch = getch()) != ERR) {
+    if ((ch = read_key()) != ERR) {
 
       if (ch == KEY_UP) {
 	
@@ -637,161 +5587,122 @@ void insert_ranking_name(char *name)
 }
 
 
-bool top_score(struct Ranking rankings[MAX_RANKINGS + 1], long new_score)
+enum GameState game_screen(struct Session *session, bool resume)
 {
-  return new_score > rankings[MAX_RANKINGS - 1].score;
-}
+  struct EventLog *log = session->log;
+  struct Broadcast *bc = session->bc;
+  struct Clock *clock = session->clock;
 
+  /* Create the game window hierarchy */
+  struct GameWindows wins;
+  open_game_windows(&wins);
 
-void record_ranking(struct Ranking rankings[MAX_RANKINGS + 1], char *new_name, long new_score)
-{
-  /* Add new ranking in the temporary slot */
-  strncpy(rankings[MAX_RANKINGS].name, new_name, NAME_BUF_LEN);
-  rankings[MAX_RANKINGS].score = new_score;
+  /* Prepare the game board and pieces (seeded from rand(), unrandomised in debug builds) */
+  struct LogicThread lt = { .session = session };
 
-  /* Sort all the slots */
-  qsort(rankings, MAX_RANKINGS + 1, sizeof(*rankings), ranking_ge);
+  if (!resume || !load_game(&lt.game, &lt.difficulty, options.save_path)) {
+    game_init(&lt.game, (uint64_t)rand() << 32 | rand(), NULL, NULL);
+  }
 
-  /* Reset the temporary slot */
-  strncpy(rankings[MAX_RANKINGS].name, "???", NAME_BUF_LEN);
-  rankings[MAX_RANKINGS].score = 0L;
-}
+  lt.episode = session->trajectories ? new_episode(session->trajectories) : 0;
 
+  init_triple_buffer(&lt.frames);
+  init_key_queue(&lt.keys);
 
-enum GameState game_screen(struct Ranking rankings[MAX_RANKINGS + 1])
-{
-  /* Prepare the game board */
-  struct GameBoard *board = new_gameboard(BOARD_HEIGHT, BOARD_WIDTH);
+  /*
+   * Input, gravity and locking run on the logic thread. This one only forwards keys and
+   * draws the latest frame, skipping any that come while the terminal is still busy with
+   * the previous ones, so a slow connection can't hold the game back.
+   */
+  pthread_t logic;
+  Die(pthread_create(&logic, NULL, logic_thread, &lt) != 0);
 
-  /* Create the game window hierarchy */
-  int screen_height, screen_width;
-  getmaxyx(stdscr, screen_height, screen_width);
+  /* A SIGTERM (servers being drained) suspends the game, like the key */
+  struct sigaction on_term = { .sa_handler = request_suspend }, default_term;
+  sigemptyset(&on_term.sa_mask);
+  sigaction(SIGTERM, &on_term, &default_term);
 
-  int field_height = screen_height;
-  int field_width = 2 * screen_width / 3;
-  
-  WINDOW *field_win = newwin(field_height, field_width, 0, 0);
+  timeout(RENDER_POLL_MS);
 
-  WINDOW *side_win = newwin(screen_height, screen_width - field_width, 0, field_width);
-  
-  int board_origin_y = (field_height - board->height) / 2;
-  int board_origin_x = (field_width - board->width) / 2;
+  struct Frame *frame = NULL;
+  uint64_t drawn_seq = 0;
 
-  WINDOW *board_win = newwin(BOARD_HEIGHT, BOARD_WIDTH, board_origin_y, board_origin_x);
+  while (frame == NULL || !frame->gameover || frame->seq != drawn_seq) {
 
-  WINDOW *preview_win = newwin(PREVIEW_WIN_SIDE, PREVIEW_WIN_SIDE,
-			       board_origin_y,
-			       board_origin_x + board->width + 4);
-  
-  /* Add the basic graphical decorations */
-  draw_board(field_win, board_origin_y, board_origin_x, board->height, board->width);
-  box(field_win, ACS_VLINE, ACS_HLINE);
-  box(side_win, ACS_VLINE, ACS_HLINE);
-  box(preview_win, ACS_VLINE, ACS_HLINE);
+    accounting.running.iterations += 1;
 
-  /* Game loop */
-  
-  struct Tetromino *current_piece = new_tetromino(random_type(), SPAWN_HEIGHT, SPAWN_WIDTH,
-						  board_win);
-  struct Tetromino *preview_piece = new_tetromino(random_type(), PREVIEW_WIN_SIDE / 2 - 1,
-						  PREVIEW_WIN_SIDE / 2, preview_win);
+    chtype ch;
+    if ((ch = read_key()) != ERR) push_key(&lt.keys, ch);
 
-  long score = 0;
+    if (suspend_requested) {
+      suspend_requested = 0;
+      push_key(&lt.keys, SUSPEND_KEY);
+    }
 
-  double threshold = 1. / INITIAL_SPEED + get_real_time();
+    struct Frame *latest = take_snapshot(&lt.frames);
+    if (latest != NULL) frame = latest;
 
-  bool gameover = false;
-  
-  while (!gameover) {
+    if (frame == NULL || frame->seq == drawn_seq || output_backlogged()) continue;
 
-    double speed = speed_from_score(score);
+    draw_frame(frame, drawn_seq, wins.board, wins.preview, wins.side);
+    drawn_seq = frame->seq;
 
-    draw_updated_stats(side_win, score, speed);
+    /* Mirror the frame to spectators */
+    publish_frame(bc, wins.board, frame->score, frame->speed, frame->preview);
 
-    /* Refresh all screen assets */
-    wnoutrefresh(field_win);
-    wnoutrefresh(side_win);
-    wnoutrefresh(preview_win);
-    wnoutrefresh(board_win);
-    doupdate();
+    refresh_game_windows(&wins);
+    accounting.running.frames += 1;
+  }
 
-    /* Timed event management */
-    if (get_real_time() >= threshold) {
+  pthread_join(logic, NULL);
+  destroy_key_queue(&lt.keys);
 
-      threshold += 1. / speed;
-      
-      enum CollisionType collision = move_tetromino(current_piece, board, +1, 0, board_win);
+  accounting.running.iterations += lt.iterations;
 
-      if (collision != NO_COLLISION) {
+  sigaction(SIGTERM, &default_term, NULL);
 
-	/* Manage transformation of current piece into dead blocks, row deletion and score */
-	record_dead_blocks(current_piece, board);
+  timeout(-1);			/* The popups wait for their keys */
 
-	int num_deleted = remove_and_count_full_rows(board, current_piece->max_y,
-						     current_piece->min_y, board_win);
+  struct Game game = lt.game;
 
-	score += score_from_lines(num_deleted);
+  if (lt.suspended) {		/* Not over: no ranking, and nothing else to do */
+    flush_event_log(log);
+    free_gameboard(game.board);
+    close_game_windows(&wins);
 
-	free(current_piece);
+    return STATE_QUIT;
+  }
 
-	/* Move the tetromino object from the preview window to the board */
-	current_piece = preview_piece;
-	
-	reposition_tetromino(current_piece, SPAWN_HEIGHT, SPAWN_WIDTH,
-			     preview_win, board_win);
 
-	preview_piece = new_tetromino(random_type(), PREVIEW_WIN_SIDE / 2 - 1,
-				      PREVIEW_WIN_SIDE / 2, preview_win);
+  /* Gameover operations */
 
-	/* GAMEOVER CONDITION: the piece already collides with a dead piece as soon as it spawns */
-        if (check_collision(current_piece, board) != NO_COLLISION) {
-	  wrefresh(preview_win);
-	  wrefresh(board_win);
-          gameover = true;
-        }
+  char player_name[NAME_BUF_LEN] = "???";
 
-        continue;    /* Skip keyboard input during timed event management */
-      }
-    }
-    
-    /* Check for user event */
-    chtype ch;
-    if ((ch = getch()) != ERR) {
+  /* Games on other rules are logged, but not ranked */
+  bool ranked = ranked_rules(game.difficulty, game.board->height);
 
-      if (toupper(ch) == 'W' || ch == KEY_UP) {
-	rotate_tetromino(current_piece, board, board_win);
-      } else if (toupper(ch) == 'A' || ch == KEY_LEFT) {
-	move_tetromino(current_piece, board, 0, -1, board_win);
-      } else if (toupper(ch) == 'S' || ch == KEY_DOWN) {
-	move_tetromino(current_piece, board, +1, 0, board_win);
-      } else if (toupper(ch) == 'D' || ch == KEY_RIGHT) {
-	move_tetromino(current_piece, board, 0, +1, board_win);
-      } else {
-	gameover = ch == Ctrl('C'); /* Force-quit */
-      }
-    }
+  if (ranked && top_score(session->leaderboard, game.score)) {
+    insert_ranking_name(player_name);
+    record_ranking(session->leaderboard, player_name, game.score);
   }
 
+  log_event(log, EV_GAMEOVER, clock->now(clock), game.score,
+	    (long)player_name[0] << 16 | (long)player_name[1] << 8 | (long)player_name[2]);
+  flush_event_log(log);		/* Handed to the I/O thread, not waited for */
 
-  /* Gameover operations */
+  /* Every ranked game goes to the score index, among all those before it */
+  long rank = 0, total = 0;
 
-  if (top_score(rankings, score)) {
-    char player_name[NAME_BUF_LEN];
-    insert_ranking_name(player_name);
-    record_ranking(rankings, player_name, score);
+  if (ranked) {
+    rank = score_index_insert(session->scores, player_name, game.score, time(NULL), &total);
   }
 
-  enum GameState next_state = manage_gameover();
+  enum GameState next_state = manage_gameover(rank, total);
 
   /* Cleanup */
-  free(current_piece);
-  free(preview_piece);
-  free_gameboard(board);
+  free_gameboard(game.board);
 
-  delwin(board_win);
-  delwin(preview_win);
-  delwin(side_win);
-  delwin(field_win);
+  close_game_windows(&wins);
   
   return next_state;
 }
@@ -804,11 +5715,221 @@ void query_save_scores(void)
 }
 
 
-int main(void)
+void parse_options(int argc, char *argv[])
+{
+  static struct option long_options[] = {
+    {"event-log", required_argument, NULL, 'e'},
+    {"stats", no_argument, NULL, 's'},
+    {"broadcast", no_argument, NULL, 'b'},
+    {"watch", optional_argument, NULL, 'w'},
+    {"tournament", no_argument, NULL, 't'},
+    {"games", required_argument, NULL, 'g'},
+    {"seed", required_argument, NULL, 'S'},
+    {"threads", required_argument, NULL, 'j'},
+    {"max-pieces", required_argument, NULL, 'm'},
+    {"dump-trajectories", required_argument, NULL, 'T'},
+    {"clear-animation", no_argument, NULL, 'c'},
+    {"time-warp", required_argument, NULL, 'W'},
+    {"gravity-test", no_argument, NULL, 'G'},
+    {"input-rate", required_argument, NULL, 'r'},
+    {"render-bench", no_argument, NULL, 'R'},
+    {"save-file", required_argument, NULL, 'f'},
+    {"tune", no_argument, NULL, 'u'},
+    {"generations", required_argument, NULL, 'n'},
+    {"population", required_argument, NULL, 'p'},
+    {"score-index", required_argument, NULL, 'i'},
+    {"board-height", required_argument, NULL, 'H'},
+    {"versus", required_argument, NULL, 'v'},
+    {"port", required_argument, NULL, 'P'},
+    {"latency", required_argument, NULL, 'l'},
+    {"pc-generate", no_argument, NULL, 'x'},
+    {"pc-db", required_argument, NULL, 'D'},
+    {"pc-hint", no_argument, NULL, 'h'},
+    {"sweep", no_argument, NULL, 'y'},
+    {"initial-speed", required_argument, NULL, 'I'},
+    {"speed-increment", required_argument, NULL, 'C'},
+    {"score-modulus", required_argument, NULL, 'M'},
+    {"line-scores", required_argument, NULL, 'L'},
+    {"usage-report", optional_argument, NULL, 'U'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int opt;
+  
+  while ((opt = getopt_long(argc, argv, "e:sbw::tg:S:j:m:T:cW:Gr:Rf:un:p:i:H:v:P:l:xD:hyI:C:M:L:U::", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'e': options.event_log_path = optarg; break;
+    case 's': options.stats_mode = true; break;
+    case 'b': options.broadcast = true; break;
+    case 'w':
+      options.watch_mode = true;
+      if (optarg != NULL) options.watch_pid = atoi(optarg);
+      break;
+    case 't': options.tournament_mode = true; break;
+    case 'g': options.games = atoi(optarg); break;
+    case 'S': options.seed = strtoull(optarg, NULL, 0); break;
+    case 'j': options.threads = atoi(optarg); break;
+    case 'm': options.max_pieces = atol(optarg); break;
+    case 'T': options.trajectory_path = optarg; break;
+    case 'c': options.clear_animation = true; break;
+    case 'W': options.time_warp = atof(optarg); break;
+    case 'G': options.gravity_test_mode = true; break;
+    case 'r': options.input_rate = atof(optarg); break;
+    case 'R': options.render_bench = true; break;
+    case 'f': options.save_path = optarg; break;
+    case 'u': options.tune_mode = true; break;
+    case 'n': options.generations = atoi(optarg); break;
+    case 'p': options.population = atoi(optarg); break;
+    case 'i': options.score_index_path = optarg; break;
+    case 'H': options.board_height = atoi(optarg); break;
+    case 'v': options.versus_peer = optarg; break;
+    case 'P': options.versus_port = atoi(optarg); break;
+    case 'l': options.latency_ms = atoi(optarg); break;
+    case 'x': options.pc_generate = true; break;
+    case 'D': options.pc_db_path = optarg; break;
+    case 'h': options.pc_hint = true; break;
+    case 'y': options.sweep_mode = true; break;
+    case 'I': options.difficulty_lists[PARAM_INITIAL_SPEED] = optarg; break;
+    case 'C': options.difficulty_lists[PARAM_SPEED_INCREMENT] = optarg; break;
+    case 'M': options.difficulty_lists[PARAM_SCORE_MODULUS] = optarg; break;
+    case 'L': options.difficulty_lists[PARAM_LINE_SCORES] = optarg; break;
+    case 'U': options.usage_report = true; options.usage_report_path = optarg; break;
+    default:
+      fprintf(stderr, "Usage: %s [--event-log FILE] [--broadcast] [--dump-trajectories FILE]"
+	      " [--clear-animation] [--time-warp X] [--save-file FILE]\n"
+	      "          [--score-index FILE] [--board-height N] [--pc-hint] [--pc-db FILE]"
+	      " [--usage-report[=FILE]] [RULES]\n"
+	      "       %s --stats FILE...\n"
+	      "       %s --watch[=PID]\n"
+	      "       %s --versus HOST:PORT [--port N] [--latency MS] [--board-height N] [RULES]\n"
+	      "       %s --tournament [--games N] [--seed S] [--threads N] [--max-pieces N]"
+	      " [--dump-trajectories FILE]\n"
+	      "          [--score-index FILE] [--board-height N] [--pc-db FILE] [POLICY...]\n"
+	      "       %s --gravity-test [--games N] [--seed S] [--threads N] [--max-pieces N]"
+	      " [--input-rate R]\n"
+	      "          [--board-height N] [RULES] [POLICY]\n"
+	      "       %s --sweep [--games N] [--seed S] [--threads N] [--max-pieces N] [--input-rate R]\n"
+	      "          [--board-height N] [RULE LISTS] [POLICY]\n"
+	      "       %s --tune [--generations N] [--population N] [--games N] [--seed S]"
+	      " [--threads N] [--max-pieces N]\n"
+	      "          [--board-height N] [POLICY]\n"
+	      "       %s --render-bench [--games N] [--seed S] [--board-height N]\n"
+	      "       %s --pc-generate [--threads N] [--pc-db FILE]\n"
+	      "RULES: [--initial-speed X] [--speed-increment X] [--score-modulus N]"
+	      " [--line-scores N/N/N/N]\n"
+	      "RULE LISTS: the same, each with comma-separated values\n",
+	      argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+	      argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (options.board_height < BOARD_HEIGHT || options.board_height > MAX_BOARD_HEIGHT) {
+    fprintf(stderr, "--board-height: must be between %d and %d\n", BOARD_HEIGHT,
+	    MAX_BOARD_HEIGHT);
+    exit(EXIT_FAILURE);
+  }
+
+  if (options.time_warp != 0.
+      && !(options.time_warp >= 1. && options.time_warp <= MAX_TIME_WARP)) {
+    fprintf(stderr, "--time-warp: must be between 1 and %g\n", MAX_TIME_WARP);
+    exit(EXIT_FAILURE);
+  }
+
+  /* Outside a sweep, each difficulty parameter takes a single value */
+  for (int p = 0; p < NUM_DIFFICULTY_PARAMS && !options.sweep_mode; ++p) {
+    if (options.difficulty_lists[p] != NULL
+	&& !set_difficulty_param(&options.difficulty, p, options.difficulty_lists[p])) {
+      fprintf(stderr, "%s: not a valid value (lists are only for --sweep)\n",
+	      difficulty_param_names[p]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* Trajectory records keep the board as a fixed array of row masks */
+  if (options.trajectory_path != NULL && options.board_height != BOARD_HEIGHT) {
+    fprintf(stderr, "--dump-trajectories: only with the default board height\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* A suspended game waits in the home directory by default */
+  if (options.save_path == NULL) {
+    static char default_path[PATH_MAX];
+    char *home = getenv("HOME");
+    snprintf(default_path, sizeof(default_path), "%s/%s", home != NULL ? home : ".",
+	     SAVE_FILE_NAME);
+    options.save_path = default_path;
+  }
+
+  if (options.pc_db_path == NULL) {
+    static char default_path[PATH_MAX];
+    char *home = getenv("HOME");
+    snprintf(default_path, sizeof(default_path), "%s/%s", home != NULL ? home : ".",
+	     PC_DB_NAME);
+    options.pc_db_path = default_path;
+  }
+}
+
+
+int main(int argc, char *argv[])
 {
+  parse_options(argc, argv);
+
+  if (options.stats_mode) return event_log_stats(argc - optind, argv + optind);
+
+  if (options.watch_mode) return watch_screen();
+
+  if (options.versus_peer != NULL) return versus_screen();
+
+  if (options.tournament_mode) return tournament(argc - optind, argv + optind);
+
+  if (options.gravity_test_mode) return gravity_test(argc - optind, argv + optind);
+
+  if (options.tune_mode) return tune(argc - optind, argv + optind);
+
+  if (options.sweep_mode) return difficulty_sweep(argc - optind, argv + optind);
+
+  if (options.render_bench) return render_bench();
+
+  if (options.pc_generate) return pc_generate();
+
+  atexit(&write_usage_report);	/* After the terminal is restored: exit handlers go in reverse */
+
   initialize();
 
-  struct Ranking rankings[MAX_RANKINGS + 1] = INIT_RANKINGS;
+  timeout(-1);			/* Menus wait for keys rather than poll for them */
+
+  /* A virtual clock would run out the game before any key came: it's for bots only */
+  struct Clock real_clock = { real_clock_now, real_clock_skip_to, 0., 1. };
+  struct Clock warped_clock = { warped_clock_now, real_clock_skip_to, get_real_time(),
+				options.time_warp };
+
+  struct Session session = {
+    .leaderboard = open_leaderboard(),
+    .log = NULL,
+    .bc = NULL,
+    .trajectories = NULL,
+    .scores = NULL,
+    .clock = options.time_warp > 0. ? &warped_clock : &real_clock
+  };
+
+  /* Interactive games are always indexed, in the home directory unless told otherwise */
+  if (options.score_index_path == NULL) {
+    char path[PATH_MAX];
+    char *home = getenv("HOME");
+    snprintf(path, sizeof(path), "%s/%s", home != NULL ? home : ".", SCORE_INDEX_NAME);
+    session.scores = open_score_index(path);
+  } else {
+    session.scores = open_score_index(options.score_index_path);
+  }
+
+  if (options.event_log_path != NULL) session.log = open_event_log(options.event_log_path);
+
+  if (options.broadcast) session.bc = open_broadcast();
+
+  if (options.trajectory_path != NULL) {
+    session.trajectories = open_trajectory_writer(options.trajectory_path);
+  }
   
   enum GameState next_state = STATE_TITLE;  
   
@@ -816,15 +5937,21 @@ int main(void)
 
     if (next_state == STATE_TITLE) {
       
+      begin_phase(PHASE_TITLE);
       next_state = title_screen();
+      end_phase();
       
-    } else if (next_state == STATE_GAME) {
-      
-      next_state = game_screen(rankings);
+    } else if (next_state == STATE_GAME || next_state == STATE_RESUME) {
       
+      begin_phase(PHASE_GAME);
+      next_state = game_screen(&session, next_state == STATE_RESUME);
+      end_phase();
+
     } else if (next_state == STATE_SCORES) {
       
-      next_state = score_screen(rankings);
+      begin_phase(PHASE_SCORES);
+      next_state = score_screen(session.leaderboard, session.scores);
+      end_phase();
       
     } else {			/* Quitting */
       
@@ -832,4 +5959,9 @@ int main(void)
       break;
     }
   }
+
+  close_event_log(session.log);
+  close_broadcast(session.bc);
+  close_trajectory_writer(session.trajectories);
+  close_score_index(session.scores);
 }
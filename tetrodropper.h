@@ -2,11 +2,16 @@
 #define H_TETRODROPPER_H
 
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ncurses.h>
+#include <sys/socket.h>
 
 
 #define Min(a, b)	((a) < (b) ? (a) : (b))
@@ -18,7 +23,9 @@
 #define NextChar(ch)	'A' + (ch - 'A' + 1) % 26; /* Next capital letter, wrapping to 'A' after 'Z' */
 #define PrevChar(ch)	'A' + (ch - 'A' + 25) % 26 /* Previous capital letter, wrapping */
 
-#define BOARD_HEIGHT		16
+#define BOARD_HEIGHT		16 /* Default board height, and the rows the game screen shows */
+#define MAX_BOARD_HEIGHT	16384 /* Bots keep a few bytes per board row on the stack */
+#define VIEW_MARGIN		(BOARD_HEIGHT / 4) /* Rows shown above the falling piece on tall boards */
 #define BOARD_WIDTH		10
 #define SPAWN_HEIGHT		1 /* Vertical displacement of the center of a new spawned piece */
 #define SPAWN_WIDTH		(BOARD_WIDTH / 2) /* Horizontal alignment of new spawned piece */
@@ -29,6 +36,77 @@
 #define TITLE_WIDTH		73
 #define MAX_RANKINGS		10
 #define NAME_BUF_LEN		4 /* Number of bytes in the ranking initials string */
+#define EVENT_LOG_BUF_LEN	(1 << 16) /* Bytes buffered before the event log is handed to its thread */
+#define EVENT_LOG_MAGIC		"TDEVLOG" /* Event log file signature, followed by a version byte */
+#define EVENT_LOG_VERSION	1
+#define MAX_EVENT_FIELDS	4
+#define MAX_EVENT_LEN		(1 + 10 * (1 + MAX_EVENT_FIELDS)) /* Tag, time delta and fields */
+#define BROADCAST_SHM_NAME	"/tetrodropper-broadcast-%u-%d" /* One per user id and player process */
+#define BROADCAST_SHM_DIR	"/dev/shm" /* Where watchers look for broadcasting games */
+#define BROADCAST_STALL_MS	1000 /* A keyframe half written for longer: the player is gone */
+#define BROADCAST_MAGIC		0x54444243 /* "TDBC" */
+#define BROADCAST_RING_LEN	4096 /* Slots in the spectator ring (must be a power of two) */
+#define WATCH_POLL_MS		15 /* Watcher sleep between ring polls */
+#define MAX_CANDIDATES		(4 * BOARD_WIDTH) /* Placements a bot can choose from, at most */
+#define MAX_POLICIES		16
+#define LEADERBOARD_SHM_NAME	"/tetrodropper-rankings-%u" /* One per user id */
+#define LEADERBOARD_MAGIC	0x54445232 /* "TDR2" */
+#define LEADERBOARD_INIT_TIMEOUT 2.0 /* Seconds to wait for a live creator, before going private */
+#define TRAJECTORY_MAGIC	"TDTRAJ1" /* Chunk signature (8 bytes with the terminator) */
+#define TRAJECTORY_CHUNK_LEN	4096 /* Transitions per chunk (at least) */
+#define CLEAR_FLASH_TIME	0.15 /* Seconds cleared rows stay highlighted, with --clear-animation */
+#define DEFAULT_INPUT_RATE	10.0 /* Inputs per second of a timed bot */
+#define MAX_TIME_WARP		8.0 /* Fastest interactive --time-warp: a player must keep up */
+#define MAX_LEVELS		64 /* Speed levels tracked by the gravity test */
+#define FEATURE_BATCH		8 /* Candidate boards evaluated together, one per vector lane */
+#define KEY_QUEUE_LEN		64 /* Keys read by the render thread, not yet seen by the logic */
+#define RENDER_POLL_MS		10 /* Render thread wait for a key, between frame checks */
+#define RENDER_BACKLOG_BYTES	512 /* Terminal output still queued above which frames are dropped */
+#define BENCH_ROWS		25 /* Size of the render benchmark's pseudo-terminal */
+#define BENCH_COLS		80
+#define BENCH_FRAMES		16 /* Measured frames per run of the longer scenarios */
+#define BENCH_MARKER		0xFF /* Sent after each frame, never part of the ncurses output */
+#define SAVE_MAGIC		"TDSAVE1" /* Suspended game signature (8 bytes with the terminator) */
+#define SAVE_VERSION		3
+#define SAVE_FILE_NAME		".tetrodropper.sav" /* In $HOME, unless --save-file says otherwise */
+#define SUSPEND_KEY		Ctrl('Z')
+#define TRACE_RING_LEN		65536 /* Trace events kept per thread (a power of two) */
+#define TRACE_MAX_THREADS	64
+#define TRACE_FILE_NAME		"tetrodropper-trace.json" /* Unless $TETRODROPPER_TRACE says */
+#define SCORE_INDEX_MAGIC	"TDSCORE" /* Score index file signature (8 bytes with the terminator) */
+#define SCORE_INDEX_VERSION	2
+#define SCORE_INDEX_NAME	".tetrodropper-scores" /* In $HOME, unless --score-index says */
+#define SCORE_INDEX_INITIAL	1024 /* Nodes in a new index file, doubled whenever full */
+#define SCORE_NAME_LEN		16
+#define SCORE_PAGE_LEN		10 /* Games per page of the score screen */
+#define FRAME_FRESH		4 /* Triple buffer flag: the middle frame is newer than the front */
+#define POLICY_SYMBOL		"tetrodropper_choose" /* Entry point of a policy shared object */
+#define DEFAULT_GAMES		100 /* Games per policy in a tournament */
+#define DEFAULT_MAX_PIECES	2000 /* A simulated game is stopped after this many pieces */
+#define DEFAULT_GENERATIONS	10 /* Weight tuner iterations */
+#define DEFAULT_POPULATION	24 /* Weight vectors tried per generation */
+#define TUNE_ELITE_DIVISOR	4 /* The best quarter of a generation sets the next one */
+#define TUNE_INITIAL_SIGMA	1.0 /* Least initial spread of a weight */
+#define TUNE_MIN_SIGMA		0.05 /* Spread a weight never drops under */
+#define PC_HEIGHT		2 /* Rows of a perfect clear setup: at most 2, for the record layout */
+#define PC_MAX_PIECES		(PC_HEIGHT * BOARD_WIDTH / MAX_BLOCKS) /* Pieces that fill them */
+#define PC_MAGIC		"TDPCDB1" /* Perfect clear database signature (8 bytes, terminated) */
+#define PC_VERSION		1
+#define PC_DB_NAME		".tetrodropper-pc" /* In $HOME, unless --pc-db says otherwise */
+#define PC_BOARD_SHIFT		40 /* Record layout, see struct PcDatabaseHeader */
+#define PC_LEN_SHIFT		36
+#define PC_PIECE_BITS		3
+#define PC_KNOWN_PIECES		2 /* The current piece and the preview */
+#define PC_JOB_PIECES		2 /* Pieces of the queues a generator job is given */
+#define PC_MEMO_INITIAL		(1 << 16) /* Slots in a new search memo, doubled at half full */
+#define VERSUS_MAGIC		0x53564454 /* "TDVS", little-endian */
+#define VERSUS_TICK_HZ		60 /* Frames per second of a versus match */
+#define VERSUS_MAX_ROLLBACK	30 /* Frames a peer may run ahead of the other's inputs */
+#define VERSUS_INPUT_WINDOW	128 /* Inputs kept per player (a power of two) */
+#define VERSUS_PACKET_INPUTS	64 /* Most inputs (re)sent per packet */
+#define VERSUS_DELAY_QUEUE_LEN	256 /* Outgoing packets held back by --latency */
+#define VERSUS_LINGER_TIME	1.0 /* Seconds the last inputs are still sent after the end */
+#define VERSUS_SYNC_INTERVAL	15 /* Least frames between two ticks skipped for the peer */
 
 #ifdef NDEBUG
 
@@ -44,6 +122,11 @@
 
 #endif
 
+#define LINE_SCORES		{ 0, 100, 200, 400, 1200 } /* Points for 0 to 4 lines at once */
+#define DEFAULT_DIFFICULTY	{ INITIAL_SPEED, SPEED_INCREMENT, SCORE_MODULUS, LINE_SCORES }
+#define MAX_SWEEP_VALUES	64 /* Per parameter of a difficulty sweep */
+#define MAX_SWEEP_SETTINGS	4096 /* Points of a difficulty sweep grid */
+
 
 char title_string[TITLE_HEIGHT][1 + TITLE_WIDTH] = { /* If changed, match the lengths with the ASCII art! */
   " _____ _____ _____ _____ _____ ____  _____ _____ _____ _____ _____ _____ ",
@@ -81,18 +164,140 @@ enum TetrominoType {
   Z_TYPE,
   O_TYPE,
   T_TYPE,
-  DEAD_TYPE			/* Unused */
+  DEAD_TYPE			/* Garbage rows */
 };
 
 
 enum GameState {
   STATE_TITLE,
   STATE_GAME,
+  STATE_RESUME,
   STATE_SCORES,
   STATE_QUIT
 };
 
 
+/*
+ * Event log records. Each record is the tag byte, the time elapsed since the previous
+ * record (in microseconds) and a tag-dependent number of fields, all as zigzag varints
+ */
+enum EventType {
+  EV_GAME_START = 1,		/* Fields: epoch seconds */
+  EV_SPAWN,			/* Fields: tetromino type */
+  EV_LOCK,			/* Fields: tetromino type, rotation state, center y, center x */
+  EV_ROWS,			/* Fields: number of cleared rows */
+  EV_SCORE,			/* Fields: score change */
+  EV_SPEED,			/* Fields: new speed in thousandths */
+  EV_GAMEOVER,			/* Fields: final score, packed player initials */
+  MAX_EVENT_TYPE
+};
+
+
+enum FrameEventKind {
+  FRAME_CELL = 1,		/* A board cell changed: value is the color pair, or 0 if empty */
+  FRAME_SCORE,
+  FRAME_SPEED,			/* Value in thousandths */
+  FRAME_PREVIEW,		/* Value is the tetromino type in the preview window */
+  FRAME_END			/* The preceding diffs form a complete frame */
+};
+
+
+/* Board features a bot weighs to score a candidate placement */
+enum Feature {
+  FEAT_HEIGHT,			/* Sum of the column heights */
+  FEAT_BUMPINESS,		/* Sum of the height differences of adjacent columns */
+  FEAT_HOLES,			/* Empty cells covered by a filled one */
+  FEAT_WELLS,			/* Open empty cells with both neighbours filled (walls count) */
+  FEAT_ROW_TRANSITIONS,		/* Filled/empty changes along the rows (walls count) */
+  FEAT_COL_TRANSITIONS,		/* Filled/empty changes along the columns (floor counts) */
+  FEAT_LINES,			/* Rows completed by the placement */
+  FEAT_LANDING,			/* Height of the center of the placed piece */
+  NUM_FEATURES
+};
+
+
+/* Columns of a trajectory chunk, stored in this order */
+enum TrajectoryColumn {
+  COL_BOARD,			/* Board before the move, BOARD_HEIGHT little-endian row masks */
+  COL_EPISODE,			/* uint32: game counter, unique within the file */
+  COL_STEP,			/* uint32: piece number within the game */
+  COL_REWARD,			/* int32: score earned by the move */
+  COL_PIECE,			/* uint8: type of the piece being placed */
+  COL_PREVIEW,			/* uint8: type of the next piece */
+  COL_ROTATION,			/* uint8: rotation state the piece was locked in */
+  COL_X,			/* uint8: column of the locked piece's center */
+  COL_Y,			/* uint8: row of the locked piece's center */
+  COL_DONE,			/* uint8: 1 if the game ended after this move */
+  NUM_TRAJECTORY_COLUMNS
+};
+
+
+enum BenchScenario {
+  BENCH_REDRAW,			/* First paint of the game screen */
+  BENCH_FALL,			/* Pieces falling one row per frame, and locking */
+  BENCH_ROTATE,
+  BENCH_TETRIS,			/* The frame where four rows collapse */
+  BENCH_COLLAPSE,		/* A single row cleared under a tall stack, which all moves */
+  BENCH_STATS,			/* Only the score changes */
+  NUM_BENCH_SCENARIOS
+};
+
+
+/* Gravity and scoring rules: the build's defaults, unless the command line says otherwise */
+struct Difficulty {
+  double	initial_speed;
+  double	speed_increment; /* Added every score_modulus points */
+  long		score_modulus;
+  long		line_scores[1 + MAX_BLOCKS]; /* Points for clearing as many lines at once */
+};
+
+
+enum DifficultyParam {
+  PARAM_INITIAL_SPEED,
+  PARAM_SPEED_INCREMENT,
+  PARAM_SCORE_MODULUS,
+  PARAM_LINE_SCORES,
+  NUM_DIFFICULTY_PARAMS
+};
+
+
+struct Options {
+  char *	event_log_path;	/* Where to append the binary event stream (NULL: disabled) */
+  bool		stats_mode;	/* Analyse event logs instead of playing */
+  bool		broadcast;	/* Publish frames to spectators */
+  bool		watch_mode;	/* Spectate a broadcasting game instead of playing */
+  int		watch_pid;	/* The player process to watch (0: the only one) */
+  bool		tournament_mode; /* Pit bot policies against each other instead of playing */
+  int		games;		/* Simulated games per policy */
+  uint64_t	seed;		/* Base seed of the simulated piece sequences */
+  int		threads;	/* Simulator threads (0: one per core) */
+  long		max_pieces;	/* Simulated game length cap */
+  char *	trajectory_path; /* Where to dump (state, action, reward) tuples (NULL: disabled) */
+  bool		clear_animation; /* Flash cleared rows before collapsing them */
+  double	time_warp;	/* Game seconds per real second (0: real time) */
+  bool		gravity_test_mode; /* Time bot games on a virtual clock instead of playing */
+  double	input_rate;	/* Inputs per second of the timed bot */
+  bool		render_bench;	/* Measure the rendering cost of scripted frames on a pty */
+  char *	save_path;	/* Where a suspended game is kept */
+  bool		tune_mode;	/* Search for better bot weights instead of playing */
+  int		generations;	/* Weight tuner iterations */
+  int		population;	/* Weight vectors per tuner generation */
+  char *	score_index_path; /* Where every game is indexed (NULL: the default, if playing) */
+  int		board_height;	/* Rows of the board, of which the game screen shows BOARD_HEIGHT */
+  char *	versus_peer;	/* HOST:PORT of the opponent in a versus match (NULL: none) */
+  int		versus_port;	/* Local UDP port of a versus match */
+  int		latency_ms;	/* Delay added to every outgoing versus packet */
+  bool		pc_generate;	/* Build the perfect clear database instead of playing */
+  char *	pc_db_path;	/* Where the perfect clear database is */
+  bool		pc_hint;	/* Show the placement most likely to lead to a perfect clear */
+  struct Difficulty difficulty;	/* Of every game, except in a sweep */
+  char *	difficulty_lists[NUM_DIFFICULTY_PARAMS]; /* As given, comma-separated in a sweep */
+  bool		sweep_mode;	/* Time bot games over a grid of difficulties instead of playing */
+  bool		usage_report;	/* Report the resources used by each phase, at exit */
+  char *	usage_report_path; /* Where to (NULL: standard error) */
+};
+
+
 struct Point {
     int y;
     int x;
@@ -104,6 +309,23 @@ struct Ranking {
   long score;
 };
 
+
+/*
+ * Top-10 rankings shared by every tetrodropper process of a user. Writers take turns on
+ * a robust mutex and make the sequence number odd while they change the table; readers
+ * copy the table and retry if the sequence number moved, so they never hold anybody up.
+ * A writer that dies halfway is undone from the backup by the next process to take the
+ * mutex, which a reader also does when it finds the sequence number stuck odd.
+ */
+struct Leaderboard {
+  _Atomic uint32_t	magic;
+  _Atomic int32_t	owner;	/* Process filling in a new segment (0: none yet) */
+  pthread_mutex_t	lock;	/* Process-shared and robust, for writers */
+  _Atomic uint64_t	seq;
+  struct Ranking	rankings[MAX_RANKINGS];
+  struct Ranking	backup[MAX_RANKINGS]; /* The table as it was before the current write */
+};
+
   
 struct GameBoard {
   int		height;
@@ -113,7 +335,136 @@ struct GameBoard {
   int		spawn_point_y;
   int		spawn_point_x;
   int		floor_y;
-  bool **	is_filled;
+  int		top;		/* Slot of row 0: rows are kept in a ring */
+  int		stack_top;	/* No dead block above this row */
+  uint8_t *	cells;		/* Ring of rows. 0 if empty, else the type of the dead block */
+};
+
+
+struct EventBuffer {
+  unsigned char *	bytes;
+  size_t		len;
+  size_t		cap;
+};
+
+
+/*
+ * Double-buffered like the trajectory writer: the game appends to 'filling', and the I/O
+ * thread swaps it out once nearly full (or when asked to flush), then writes it without
+ * holding the lock. The game loop never waits for the disk.
+ */
+struct EventLog {
+  int			fd;
+  pthread_t		thread;
+  pthread_mutex_t	lock;
+  pthread_cond_t	wakeup;
+  struct EventBuffer	buffer[2];
+  struct EventBuffer *	filling;
+  struct EventBuffer *	pending; /* Being written by the I/O thread, or NULL */
+  bool			flushing; /* Write out 'filling' even if not full */
+  bool			closing;
+  double		last_time;
+};
+
+
+struct FrameEvent {
+  uint8_t	kind;
+  uint8_t	y;
+  uint8_t	x;
+  int64_t	value;
+};
+
+
+/*
+ * Every game ever played, in a file shared by all processes (under flock): a treap ordered
+ * by score, highest first, where subtree sizes give ranks. Nodes are numbered from 1 in
+ * insertion order, and 0 is the empty subtree.
+ */
+struct ScoreIndexHeader {
+  char			magic[8];
+  uint32_t		version;
+  uint32_t		root;
+  uint64_t		count;
+  uint64_t		capacity; /* Nodes the file has room for */
+  uint64_t		dirty;	/* Links being updated: rebuilt by the next to lock */
+};
+
+
+struct ScoreNode {
+  int64_t		score;
+  int64_t		time;	/* When the game ended */
+  uint32_t		left;	/* Higher scores */
+  uint32_t		right;	/* Lower or equal scores, the later games */
+  uint32_t		size;	/* Nodes in this subtree */
+  uint32_t		priority; /* Heap order, above the children's */
+  char			name[SCORE_NAME_LEN];
+};
+
+
+struct ScoreIndex {
+  int			fd;
+  uint64_t		capacity; /* Nodes mapped */
+  struct ScoreIndexHeader *header; /* The whole file, the nodes right after the header */
+  struct ScoreNode *	nodes;
+};
+
+
+/*
+ * Shared-memory spectator ring: one producer (the player) and any number of watchers.
+ * Each broadcasting game creates its own segment, named after its user and process id.
+ * Every slot is a seqlock tagged with the ring position it holds, so a reader can tell
+ * "not yet written" from "overwritten" and never needs to be waited for. A seqlocked
+ * keyframe of the whole board lets watchers that fell behind resynchronise.
+ */
+struct BroadcastSlot {
+  _Atomic uint64_t	seq;	/* 2 * pos + 1 while writing, 2 * pos + 2 when complete */
+  struct FrameEvent	event;
+};
+
+
+struct Keyframe {
+  uint64_t	pos;		/* Ring position the keyframe is up to date with */
+  long		score;
+  int64_t	speed;
+  int		preview;
+  uint8_t	cells[BOARD_HEIGHT][BOARD_WIDTH];
+};
+
+
+struct BroadcastRing {
+  uint32_t		magic;
+  int			height;
+  int			width;
+  int32_t		owner;	/* Pid of the producer */
+  atomic_bool		ended;	/* Set by the producer when it stops broadcasting */
+  _Atomic uint64_t	head;	/* Next ring position to be written */
+  _Atomic uint64_t	keyframe_seq; /* Odd while the keyframe is being rewritten */
+  struct Keyframe	keyframe;
+  struct BroadcastSlot	slot[BROADCAST_RING_LEN];
+};
+
+
+/* Producer side, private to the player's process */
+struct Broadcast {
+  struct BroadcastRing *	ring;
+  char				name[NAME_MAX + 2]; /* For shm_open(): a slash, then a file name */
+  uint8_t			cells[BOARD_HEIGHT][BOARD_WIDTH]; /* Last published frame */
+  long				score;
+  int64_t			speed;
+  int				preview;
+};
+
+
+/* Per-player aggregate computed by the event log analyser */
+struct PlayerStats {
+  char		name[NAME_BUF_LEN];
+  long		games;
+  long		pieces;
+  long		total_score;
+  long		best_score;
+  long		type_count[1 + MAX_TYPES];
+  long		clear_count[1 + MAX_BLOCKS];
+  double	piece_time;	/* Seconds between spawn and lock, summed over all pieces */
 };
 
 
@@ -131,6 +482,489 @@ struct Tetromino {
 };
 
 
+/*
+ * Trace points, compiled in with -D TRACE (make TRACE=1) and to nothing otherwise. Each
+ * thread records into its own ring, dumped as Chrome trace JSON (chrome://tracing,
+ * Perfetto) at exit.
+ */
+#ifdef TRACE
+#define TraceBegin(name)	trace_event((name), 'B')
+#define TraceEnd(name)		trace_event((name), 'E')
+#else
+#define TraceBegin(name)	((void)0)
+#define TraceEnd(name)		((void)0)
+#endif
+
+
+struct TraceEvent {
+  uint64_t		ticks;	/* Raw trace_clock() reading */
+  const char *		name;	/* A string literal */
+  char			phase;	/* 'B'egin or 'E'nd */
+};
+
+
+struct TraceRing {
+  _Atomic uint64_t	head;	/* Events recorded so far */
+  atomic_bool		idle;	/* Its thread has exited, the next one to start takes it */
+  int			tid;	/* Shared by the threads that used the ring in turn */
+  struct TraceEvent	events[TRACE_RING_LEN];
+};
+
+
+struct TraceState {
+  struct TraceRing * _Atomic rings[TRACE_MAX_THREADS];
+  atomic_int		num_rings;
+  uint64_t		start_ticks;
+  uint64_t		start_ns;
+  pthread_key_t		key;	/* Gives the ring back when its thread exits */
+};
+
+
+/*
+ * Source of game time. The real clock follows the wall clock, and can't skip. A virtual
+ * clock stands still until told to skip to the next event, so timed games run as fast
+ * as the CPU allows.
+ */
+struct Clock {
+  double	(*now)(struct Clock *clock);
+  void		(*skip_to)(struct Clock *clock, double time);
+  double	time;		/* Current time of a virtual clock, start of a warped one */
+  double	rate;		/* Game seconds per real second */
+};
+
+
+/* Game state shared by the interactive game and the simulator */
+struct Game {
+  struct GameBoard *	board;
+  struct Tetromino	current;
+  struct Tetromino	preview;
+  uint64_t		rng;	/* Piece sequence generator state */
+  double		threshold; /* Clock time of the next gravity step */
+  long			score;
+  long			lines;
+  long			pieces;
+  int			cleared[MAX_BLOCKS]; /* Rows deleted by the last lock, bottom first */
+  int			view_top; /* First row on screen in the last frame */
+  const struct Difficulty *difficulty;
+  bool			gameover;
+};
+
+
+/* The windows of the game screen */
+struct GameWindows {
+  WINDOW *	field;
+  WINDOW *	side;
+  WINDOW *	board;
+  WINDOW *	preview;
+};
+
+
+/*
+ * Immutable picture of a running game, published by the logic thread for the renderer.
+ * Rows are those cleared since the previous frame, or still flashing before their clear.
+ */
+struct Frame {
+  uint64_t		seq;
+  int			view_top; /* Board row shown at the top of the screen */
+  uint8_t		cells[BOARD_HEIGHT][BOARD_WIDTH]; /* Dead blocks and falling piece, by type */
+  int			rows[MAX_BLOCKS]; /* On screen: rows outside the view are left out */
+  struct Point		hint[MAX_BLOCKS]; /* On screen, with --pc-hint */
+  double		pc_chance; /* Of a perfect clear after the hinted placement (0: no hint) */
+  int			num_rows;
+  bool			flashing;
+  enum TetrominoType	preview;
+  long			score;
+  double		speed;
+  bool			gameover;
+};
+
+
+/*
+ * Three frames: one being written, one being read, and the latest complete one in the
+ * middle. Each side swaps its own with the middle, so neither ever waits for the other,
+ * and a reader that falls behind simply skips to the newest frame.
+ */
+struct TripleBuffer {
+  struct Frame		slots[3];
+  _Atomic int		middle;	/* Slot index, FRAME_FRESH if not taken by the reader yet */
+  uint64_t		published; /* Owned by the writer, like back */
+  int			back;	/* Owned by the writer */
+  int			front;	/* Owned by the reader */
+};
+
+struct KeyQueue {
+  pthread_mutex_t	lock;
+  pthread_cond_t	wakeup;
+  int			keys[KEY_QUEUE_LEN];
+  unsigned		head;
+  unsigned		tail;
+};
+
+
+/* Pseudo-terminal the render benchmark runs ncurses on, and what came out of it */
+struct RenderBench {
+  int			master;	/* Read (and counted) by the drain thread */
+  int			slave;	/* The terminal ncurses writes to */
+  FILE *		out;
+  FILE *		in;
+  SCREEN *		screen;
+  char *		term;
+  pthread_t		drain;
+  pthread_mutex_t	lock;
+  pthread_cond_t	seen;	/* Signalled for each marker read */
+  long			bytes;	/* Since the last frame was measured */
+  long			escapes;
+  long			markers; /* Read back from the master side */
+  long			sent;	/* Written after frames */
+};
+
+
+struct BenchResult {
+  long			frames;
+  long			bytes;
+  long			max_bytes;
+  long			escapes;
+  double		update_time; /* Seconds in doupdate(), in total */
+};
+
+
+/* The parts of an interactive session resources are accounted to */
+enum Phase {
+  PHASE_TITLE,
+  PHASE_GAME,			/* Until the game over popup is dismissed */
+  PHASE_SCORES,
+  NUM_PHASES
+};
+
+
+/* Resources used by a phase, or (while it runs) the readings it started from */
+struct PhaseUsage {
+  int		visits;
+  double	wall_time;
+  double	cpu_time;	/* User and system, all threads */
+  long		wakeups;	/* Context switches, voluntary or not */
+  long		iterations;	/* Of the phase's loops, the logic thread's included */
+  long		idle_polls;	/* getch() calls that came back without a key */
+  long		frames;		/* Screen updates flushed to the terminal */
+  long		bytes_written;	/* To the terminal, by the drawing (main) thread */
+  long		peak_rss_kb;	/* Of the process, when the phase ended */
+};
+
+
+struct Accounting {
+  enum Phase		phase;
+  struct PhaseUsage	start;	/* Readings when the current phase began */
+  struct PhaseUsage	running; /* Counters of the current phase */
+  struct PhaseUsage	phases[NUM_PHASES]; /* Totals over the session */
+  struct PhaseUsage *	games;	/* Each game on its own */
+  int			num_games;
+  int			cap_games;
+};
+
+
+/*
+ * A suspended game. Native layout, as it's only read back by the same build: the version
+ * must change with struct Tetromino or the board width. The board rows follow, top first.
+ */
+struct SavedGame {
+  char			magic[8];
+  uint32_t		version;
+  uint32_t		checksum; /* CRC-32 of everything below, and of the board rows */
+  int32_t		height;
+  struct Tetromino	current;
+  struct Tetromino	preview;
+  uint64_t		rng;
+  int64_t		score;
+  int64_t		lines;
+  int64_t		pieces;
+  double		remaining; /* Seconds left until the next gravity step */
+  struct Difficulty	difficulty; /* The game keeps its rules, whatever the command line says */
+};
+
+
+/* Keys pressed by a versus player during one frame */
+enum VersusInput {
+  VS_ROTATE = 1 << 0,
+  VS_LEFT = 1 << 1,
+  VS_DOWN = 1 << 2,
+  VS_RIGHT = 1 << 3,
+  VS_RESIGN = 1 << 4
+};
+
+
+struct VersusPlayer {
+  struct Game	game;
+  uint64_t	garbage_rng;	/* Picks the holes of the garbage rows it receives */
+  int		incoming;	/* Garbage rows due at its next lock without a clear */
+  int64_t	lost_frame;	/* Frame it topped out or resigned on, -1 while playing */
+};
+
+
+/*
+ * Everything a frame step reads and writes, and so what a rollback restores. Both peers
+ * simulate both players, each one itself as player 0: the rules are symmetric.
+ */
+struct VersusState {
+  uint32_t		frame;	/* Next frame to simulate */
+  struct VersusPlayer	player[2];
+};
+
+
+/* Sent every frame: the sender's inputs the receiver may not have yet */
+struct VersusPacket {
+  uint32_t	magic;
+  uint32_t	nonce;		/* The sender's half of the match seed */
+  uint32_t	rules;		/* Hash of the board height and difficulty, which must match */
+  uint32_t	ack;		/* How many of the receiver's inputs the sender has */
+  uint32_t	frame;		/* Next frame the sender simulates */
+  int32_t	advantage;	/* Frames the sender was ahead of the receiver, as last seen */
+  uint32_t	first;		/* Frame of inputs[0] */
+  uint32_t	count;
+  uint8_t	inputs[VERSUS_PACKET_INPUTS];
+};
+
+
+struct DelayedPacket {
+  double		due;
+  struct VersusPacket	packet;
+};
+
+
+struct Versus {
+  int			fd;
+  struct sockaddr_storage peer;
+  socklen_t		peer_len;
+  uint32_t		nonce;
+  uint32_t		peer_nonce;
+  uint32_t		rules;		/* See versus_rules() */
+  bool			connected;	/* Once the peer's nonce is known */
+  bool			mismatch;	/* The peer plays by other rules: no match */
+  uint8_t		inputs[2][VERSUS_INPUT_WINDOW]; /* By frame, modulo the window */
+  uint32_t		num_inputs[2]; /* Inputs known of each player, from frame 0 on */
+  uint32_t		peer_ack;	/* Local inputs the peer is known to have */
+  struct VersusState	state;
+  struct VersusState	saved[VERSUS_MAX_ROLLBACK + 1]; /* Before frame f, in slot f % len */
+  bool			over;		/* A player lost, on a frame with no predicted input */
+  int32_t		advantage;	/* Frames ahead of the peer, as of its last packet */
+  int32_t		peer_advantage;	/* The same, as the peer sees it */
+  uint32_t		next_sync;	/* First frame a tick may be skipped again */
+  struct DelayedPacket	delayed[VERSUS_DELAY_QUEUE_LEN]; /* Ring of packets not sent yet */
+  int			delayed_head;
+  int			delayed_len;
+  long			rollbacks;
+  long			resimulated;	/* Frames stepped again by the rollbacks */
+  int			max_depth;	/* Most frames stepped again at once */
+  double		resimulate_time; /* Seconds spent on them */
+  long			stalls;		/* Ticks skipped, too far ahead of the peer's inputs */
+  long			syncs;		/* Ticks skipped to let a peer that lags behind catch up */
+};
+
+
+/* State of the game logic thread, shared with the render thread only through the queues */
+struct LogicThread {
+  struct Game		game;
+  struct Session *	session;
+  unsigned		episode;
+  struct TripleBuffer	frames;
+  struct KeyQueue	keys;
+  bool			suspended; /* Saved to disk, rather than over */
+  long			iterations; /* Of its loop, for the resource accounting */
+  struct Difficulty	difficulty; /* Of a resumed game, as saved */
+};
+
+
+/*
+ * One board row as a bit mask (bit x is column x), for FEATURE_BATCH boards at once.
+ * Plain GCC vector extensions: SSE2 on x86-64, NEON on ARM, scalar code elsewhere.
+ */
+typedef uint16_t BitRows __attribute__((vector_size(2 * FEATURE_BATCH)));
+
+_Static_assert(BOARD_WIDTH + 2 <= 16, "Bitboard rows (plus walls) must fit in 16 bits");
+
+
+/* A bot move: rotate the spawned piece, shift it to column x, drop it */
+struct Placement {
+  int	rotations;
+  int	x;
+};
+
+
+struct Candidate {
+  struct Placement	placement;
+  struct Tetromino	landed;	/* The piece at its resting position */
+};
+
+
+typedef struct Placement (*PolicyFunc)(struct Game *game, const double *weights,
+				       uint64_t *rng);
+
+
+struct Policy {
+  char		name[64];
+  PolicyFunc	choose;
+  double	weights[NUM_FEATURES];
+};
+
+
+/* One (state, action, reward) tuple */
+struct Transition {
+  uint16_t	board[BOARD_HEIGHT];
+  uint32_t	episode;
+  uint32_t	step;
+  int32_t	reward;
+  uint8_t	piece;
+  uint8_t	preview;
+  uint8_t	rotation;
+  uint8_t	x;
+  uint8_t	y;
+  uint8_t	done;
+};
+
+
+/*
+ * On-disk chunk: this header, then every column compressed on its own with zlib. Chunks
+ * are self-contained, and chunk_len leads from one to the next without decompressing.
+ */
+struct TrajectoryChunkHeader {
+  char		magic[8];
+  uint32_t	chunk_len;	/* Bytes in the chunk, header included */
+  uint32_t	num_records;
+  uint16_t	board_height;
+  uint16_t	board_width;
+  uint32_t	column_len[NUM_TRAJECTORY_COLUMNS]; /* Compressed bytes of each column */
+};
+
+
+struct TransitionBuffer {
+  struct Transition *	records;
+  int			len;
+  int			cap;
+};
+
+
+/*
+ * Double-buffered writer: producers append to 'filling', and the I/O thread swaps it out
+ * once it holds a chunk's worth, then compresses and writes it without holding the lock.
+ * If the disk falls behind, 'filling' just keeps growing: producers never wait for it.
+ */
+struct TrajectoryWriter {
+  int				fd;
+  pthread_t			thread;
+  pthread_mutex_t		lock;
+  pthread_cond_t		wakeup;
+  struct TransitionBuffer	buffer[2];
+  struct TransitionBuffer *	filling;
+  struct TransitionBuffer *	pending; /* Being written by the I/O thread, or NULL */
+  bool				closing;
+  atomic_uint			next_episode;
+};
+
+
+struct GameResult {
+  long	score;
+  long	lines;
+  long	pieces;
+};
+
+
+struct TuneEntry {
+  double	fitness;	/* Mean score over the generation's games */
+  int		index;		/* Candidate it belongs to */
+};
+
+
+/*
+ * Perfect clear database file: this header, then 'count' records in ascending order. A
+ * record packs the bottom PC_HEIGHT rows of a board (bit 10 * row + x, row 0 at the
+ * bottom), the pieces left to place (the first one in the highest bits), and a placement
+ * of the first piece after which the rest of them, in that order, clear the board:
+ *
+ *   board (20 bits) | queue length (4) | queue (10 x 3) | rotations (2) | x (4)
+ *
+ * Each placement that works has a record of its own, so all the records of a board and
+ * the first few pieces of a queue are consecutive, whatever the later pieces.
+ */
+struct PcDatabaseHeader {
+  char		magic[8];
+  uint32_t	version;
+  uint32_t	height;
+  uint64_t	count;
+};
+
+
+struct PcDatabase {
+  size_t			size;
+  struct PcDatabaseHeader *	header;
+  const uint64_t *		records;
+};
+
+
+/* Open addressing set of searched states, with whether they lead to a perfect clear */
+struct PcMemo {
+  uint64_t *	slots;		/* 0 if free, else the state's record prefix | 1 | solvable << 1 */
+  size_t	cap;
+  size_t	len;
+};
+
+
+struct PcRecords {
+  uint64_t *	records;
+  size_t	len;
+  size_t	cap;
+};
+
+
+struct PcGenerator {
+  atomic_int		next_job; /* Work queue: job k is every queue whose first pieces are k */
+  int			num_jobs;
+  pthread_mutex_t	lock;
+  struct PcRecords	found;	/* From all the workers, with duplicates */
+  long			states;	/* Searched, summed over the workers */
+};
+
+
+struct TimedResult {
+  double	survival;	/* Game time until gameover (or the piece cap) */
+  long		score;
+  long		pieces;
+  int		levels;		/* Speed levels reached, the initial one included */
+  double	level_time[MAX_LEVELS]; /* Game time at which each level was reached */
+};
+
+
+struct Sweep {
+  const struct Policy *		policy;
+  const struct Difficulty *	settings;
+  int				num_settings;
+  int				num_games;	/* Per setting, on the same seeds */
+  atomic_int			next_job;
+  struct TimedResult *		results;	/* Setting-major */
+};
+
+
+/* The services a game session plugs into */
+struct Session {
+  struct Leaderboard *		leaderboard;
+  struct EventLog *		log;
+  struct Broadcast *		bc;
+  struct TrajectoryWriter *	trajectories;
+  struct ScoreIndex *		scores;
+  struct Clock *		clock;
+};
+
+
+struct Tournament {
+  struct Policy *	policies;
+  int			num_policies;
+  int			num_games;
+  uint64_t		seed;
+  long			max_pieces;
+  atomic_int		next_job; /* Work queue: job k is game k % num_games of policy k / num_games */
+  struct GameResult *	results; /* num_policies x num_games */
+  struct TrajectoryWriter *trajectories;
+};
+
+
 /* Rankings initializer */
 #define INIT_RANKINGS				\
   {						\
@@ -143,8 +977,7 @@ struct Tetromino {
       {.name = "AAA", .score = 0},		\
       {.name = "AAA", .score = 0},		\
       {.name = "AAA", .score = 0},		\
-      {.name = "AAA", .score = 0},		\
-      {.name = "???", .score = 0}		\
+      {.name = "AAA", .score = 0}		\
   }
 
 
@@ -195,23 +1028,61 @@ struct Tetromino {
 
 void initialize(void);
 
+void init_colors(void);
+
 void cleanup(void);
 
 
 
+#ifdef TRACE
+
+/*
+ * Tracing
+ */
+
+
+uint64_t trace_clock(void);
+
+uint64_t monotonic_ns(void);
+
+void trace_start(void);
+
+void trace_unregister(void *ring);
+
+struct TraceRing *trace_register(void);
+
+void trace_event(const char *name, char phase);
+
+void trace_dump(void);
+
+#endif
+
+
+
 /* 
  * Game objects
  */
 
 
-enum TetrominoType random_type(void);
+uint64_t next_random(uint64_t *state);
+
+enum TetrominoType random_type(uint64_t *state);
   
 struct Tetromino *new_tetromino(enum TetrominoType type, int spawn_y, int spawn_x, WINDOW *win);
 
+void init_tetromino(struct Tetromino *t, enum TetrominoType type, int spawn_y, int spawn_x,
+		    WINDOW *win);
+
 struct GameBoard *new_gameboard(int height, int width);
 
 void free_gameboard(struct GameBoard *board);
 
+uint8_t *board_row(struct GameBoard *board, int y);
+
+void copy_gameboard(struct GameBoard *dst, const struct GameBoard *src);
+
+void game_init(struct Game *game, uint64_t seed, WINDOW *board_win, WINDOW *preview_win);
+
 
 
 /*
@@ -229,6 +1100,8 @@ struct Point rotate_point_90(struct Point p, int origin_y, int origin_x, bool co
 
 enum CollisionType rotate_tetromino(struct Tetromino *t, struct GameBoard *board, WINDOW *win);
 
+int drop_distance(struct Tetromino *t, struct GameBoard *board);
+
 enum CollisionType move_tetromino(struct Tetromino *t, struct GameBoard *board, int dy, int dx,
 				  WINDOW *win);
 
@@ -238,14 +1111,415 @@ void record_dead_blocks(struct Tetromino *t, struct GameBoard *board);
 
 bool row_is_full(struct GameBoard *board, int row);
 
-int remove_and_count_full_rows(struct GameBoard *board, int bottom_row, int top_row, WINDOW *win);
+void remove_row(struct GameBoard *board, int row);
+
+bool add_garbage_rows(struct GameBoard *board, int num_rows, int hole);
+
+int remove_and_count_full_rows(struct GameBoard *board, int bottom_row, int top_row, int *cleared,
+			       WINDOW *win);
+
+int game_lock_piece(struct Game *game, WINDOW *board_win, WINDOW *preview_win);
+
+long score_from_lines(const struct Difficulty *d, int num_lines);
+
+double speed_from_score(const struct Difficulty *d, long score);
 
-long score_from_lines(int num_lines);
+bool valid_rules(const struct Difficulty *d);
 
-double speed_from_score(long score);
+bool ranked_rules(const struct Difficulty *d, int board_height);
 
 double get_real_time(void);
 
+double real_clock_now(struct Clock *clock);
+
+void real_clock_skip_to(struct Clock *clock, double time);
+
+double virtual_clock_now(struct Clock *clock);
+
+void virtual_clock_skip_to(struct Clock *clock, double time);
+
+double warped_clock_now(struct Clock *clock);
+
+bool apply_gravity(struct Game *game, double now, double speed, WINDOW *board_win);
+
+
+
+/*
+ * Bots and simulation
+ */
+
+
+int enumerate_placements(struct Game *game, struct Candidate candidates[MAX_CANDIDATES]);
+
+void board_to_bits(struct GameBoard *board, uint16_t *rows);
+
+int lock_into_bits(const uint16_t *board_rows, int height, int width, struct Tetromino *landed,
+		   uint16_t *rows);
+
+BitRows popcount_lanes(BitRows v);
+
+void evaluate_feature_batch(const BitRows *rows, int height, int width,
+			    BitRows features[NUM_FEATURES]);
+
+void evaluate_candidates(struct GameBoard *board, struct Candidate *candidates, int n,
+			 double features[][NUM_FEATURES]);
+
+struct Placement heuristic_policy(struct Game *game, const double *weights, uint64_t *rng);
+
+struct Placement random_policy(struct Game *game, const double *weights, uint64_t *rng);
+
+bool split_weights(char *spec, double weights[NUM_FEATURES]);
+
+bool load_policy(const char *spec, struct Policy *policy);
+
+void apply_placement(struct Game *game, struct Placement placement);
+
+struct GameResult simulate_game(const struct Policy *policy, uint64_t seed, long max_pieces,
+				struct TrajectoryWriter *trajectories);
+
+uint64_t game_seed(uint64_t base_seed, int index);
+
+void run_workers(void *(*worker)(void *), void *arg);
+
+void *tournament_worker(void *arg);
+
+int compare_scores(const void *a, const void *b);
+
+int tournament(int num_specs, char *specs[]);
+
+struct TimedResult simulate_timed_game(const struct Policy *policy, uint64_t seed,
+				       const struct Difficulty *difficulty, struct Clock *clock);
+
+void *gravity_test_worker(void *arg);
+
+int gravity_test(int num_specs, char *specs[]);
+
+double random_gaussian(uint64_t *state);
+
+int compare_fitness(const void *a, const void *b);
+
+int tune(int num_specs, char *specs[]);
+
+
+
+/*
+ * Difficulty Sweeps
+ */
+
+bool set_difficulty_param(struct Difficulty *d, enum DifficultyParam param, const char *text);
+
+void *sweep_worker(void *arg);
+
+int compare_doubles(const void *a, const void *b);
+
+int difficulty_sweep(int num_specs, char *specs[]);
+
+
+
+/*
+ * Perfect Clears
+ */
+
+
+bool pc_board_bits(struct GameBoard *board, uint64_t *bits);
+
+uint64_t pc_state_key(uint64_t board, const int *queue, int len);
+
+int pc_memo_find(struct PcMemo *memo, uint64_t key);
+
+void pc_memo_insert(struct PcMemo *memo, uint64_t key, bool solvable);
+
+void pc_push_record(struct PcRecords *r, uint64_t record);
+
+bool pc_search(struct GameBoard **boards, const int *queue, int len, struct PcMemo *memo,
+	       struct PcRecords *found);
+
+void *pc_generator_worker(void *arg);
+
+int compare_records(const void *a, const void *b);
+
+int pc_generate(void);
+
+struct PcDatabase *open_pc_database(const char *path);
+
+void close_pc_database(struct PcDatabase *db);
+
+void load_pc_database(void);
+
+struct PcDatabase *pc_database(void);
+
+size_t pc_lower_bound(const struct PcDatabase *db, uint64_t key);
+
+double pc_lookup(const struct PcDatabase *db, struct Game *game, struct Placement *placement);
+
+struct Placement pc_policy(struct Game *game, const double *weights, uint64_t *rng);
+
+
+
+/*
+ * Trajectory dumps
+ */
+
+
+void write_trajectory_chunk(int fd, struct TransitionBuffer *chunk);
+
+void *trajectory_io_thread(void *arg);
+
+struct TrajectoryWriter *open_trajectory_writer(const char *path);
+
+void close_trajectory_writer(struct TrajectoryWriter *w);
+
+void submit_transitions(struct TrajectoryWriter *w, const struct Transition *t, int n);
+
+unsigned new_episode(struct TrajectoryWriter *w);
+
+void begin_transition(struct Game *game, unsigned episode, struct Transition *t);
+
+void end_transition(struct Game *game, long score_before, struct Transition *t);
+
+
+
+/*
+ * Event log
+ */
+
+
+size_t encode_varint(unsigned char *out, int64_t value);
+
+size_t decode_varint(const unsigned char *in, size_t len, int64_t *value);
+
+void write_all(int fd, const void *buf, size_t len);
+
+void *event_log_io_thread(void *arg);
+
+struct EventLog *open_event_log(const char *path);
+
+void log_event(struct EventLog *log, enum EventType type, double time, ...);
+
+void flush_event_log(struct EventLog *log);
+
+void close_event_log(struct EventLog *log);
+
+struct PlayerStats *find_player_stats(struct PlayerStats **players, int *num_players,
+				      const char *name);
+
+bool scan_event_log(const unsigned char *data, size_t size,
+		    struct PlayerStats **players, int *num_players);
+
+int event_log_stats(int num_paths, char *paths[]);
+
+
+
+/*
+ * Spectator broadcast
+ */
+
+
+void write_keyframe(struct Broadcast *bc);
+
+struct Broadcast *open_broadcast(void);
+
+void close_broadcast(struct Broadcast *bc);
+
+void push_frame_event(struct BroadcastRing *ring, int kind, int y, int x, int64_t value);
+
+void publish_frame(struct Broadcast *bc, WINDOW *board_win, long score, double speed,
+		   enum TetrominoType preview);
+
+bool read_keyframe(struct BroadcastRing *ring, struct Keyframe *copy);
+
+bool broadcast_alive(struct BroadcastRing *ring);
+
+int find_broadcast(char *name, size_t len);
+
+void draw_keyframe(struct Keyframe *frame, WINDOW *board_win, WINDOW *preview_win,
+		   WINDOW *side_win);
+
+int watch_screen(void);
+
+
+
+/*
+ * Leaderboard
+ */
+
+
+void init_leaderboard(struct Leaderboard *leaderboard);
+
+struct Leaderboard *open_leaderboard(void);
+
+void lock_leaderboard(struct Leaderboard *leaderboard);
+
+void read_rankings(struct Leaderboard *leaderboard, struct Ranking rankings[MAX_RANKINGS]);
+
+bool top_score(struct Leaderboard *leaderboard, long new_score);
+
+void record_ranking(struct Leaderboard *leaderboard, char *new_name, long new_score);
+
+
+
+/*
+ * Score Index
+ */
+
+
+bool lock_score_index(struct ScoreIndex *index, int operation);
+
+void unlock_score_index(struct ScoreIndex *index);
+
+size_t score_index_size(uint64_t capacity);
+
+struct ScoreIndex *open_score_index(const char *path);
+
+void close_score_index(struct ScoreIndex *index);
+
+uint32_t score_node_size(struct ScoreNode *nodes, uint32_t n);
+
+uint32_t rotate_score_node(struct ScoreNode *nodes, uint32_t n, bool right);
+
+uint32_t insert_score_node(struct ScoreNode *nodes, uint32_t root, uint32_t n);
+
+void rebuild_score_index(struct ScoreIndex *index);
+
+long rank_in_score_index(struct ScoreIndex *index, long score);
+
+long score_index_insert(struct ScoreIndex *index, const char *name, long score, time_t when,
+			long *total);
+
+long score_index_count(struct ScoreIndex *index);
+
+long score_index_rank(struct ScoreIndex *index, long score);
+
+int score_index_page(struct ScoreIndex *index, long first, int len, struct ScoreNode *page,
+		     long *total);
+
+
+
+/*
+ * Suspend and Resume
+ */
+
+
+void request_suspend(int sig);
+
+bool save_game(struct Game *game, double remaining, const char *path);
+
+bool valid_saved_piece(struct Tetromino *saved, struct GameBoard *board);
+
+bool load_game(struct Game *game, struct Difficulty *difficulty, const char *path);
+
+bool saved_game_exists(void);
+
+
+
+/*
+ * Logic Thread
+ */
+
+
+void init_key_queue(struct KeyQueue *q);
+
+void destroy_key_queue(struct KeyQueue *q);
+
+void push_key(struct KeyQueue *q, int ch);
+
+bool pop_key(struct KeyQueue *q, int *ch);
+
+void wait_for_keys(struct KeyQueue *q, double timeout);
+
+void init_triple_buffer(struct TripleBuffer *tb);
+
+struct Frame *back_frame(struct TripleBuffer *tb);
+
+void publish_snapshot(struct TripleBuffer *tb);
+
+struct Frame *take_snapshot(struct TripleBuffer *tb);
+
+void set_frame_rows(struct Frame *frame, const int *rows, int num_rows);
+
+void fill_frame(struct Frame *frame, struct Game *game, double speed, const int *rows,
+		int num_rows);
+
+void apply_key(struct Game *game, int ch);
+
+void *logic_thread(void *arg);
+
+bool output_backlogged(void);
+
+
+
+/*
+ * Versus
+ */
+
+
+void copy_versus_state(struct VersusState *dst, const struct VersusState *src);
+
+int step_versus_player(struct VersusPlayer *p, uint8_t input, uint32_t frame);
+
+void step_versus(struct VersusState *state, uint8_t input0, uint8_t input1);
+
+uint8_t versus_input(struct Versus *vs, int player, uint32_t frame);
+
+void advance_versus(struct Versus *vs);
+
+void roll_back_versus(struct Versus *vs, uint32_t frame);
+
+int open_versus_socket(struct Versus *vs, const char *peer, int port);
+
+void send_versus_packet(struct Versus *vs, double now);
+
+void flush_versus_packets(struct Versus *vs, double now);
+
+void receive_versus_packets(struct Versus *vs);
+
+void start_versus(struct Versus *vs, uint32_t peer_nonce);
+
+uint32_t versus_rules(void);
+
+uint32_t versus_checksum(struct Game *game);
+
+int versus_screen(void);
+
+
+
+/*
+ * Render Benchmark
+ */
+
+
+void *bench_drain_thread(void *arg);
+
+void open_render_bench(struct RenderBench *rb);
+
+void close_render_bench(struct RenderBench *rb);
+
+void bench_frame(struct RenderBench *rb, struct GameWindows *wins, struct Frame *frame,
+		 uint64_t *drawn_seq, struct BenchResult *result);
+
+void run_bench_scenario(struct RenderBench *rb, enum BenchScenario scenario, uint64_t seed,
+			struct BenchResult *result);
+
+int render_bench(void);
+
+
+
+/*
+ * Resource Accounting
+ */
+
+void read_usage(struct PhaseUsage *u);
+
+void begin_phase(enum Phase phase);
+
+void end_phase(void);
+
+int read_key(void);
+
+void print_usage_line(FILE *out, const char *name, const struct PhaseUsage *u);
+
+void write_usage_report(void);
+
 
 
 /*
@@ -259,10 +1533,21 @@ void delete_tetromino(WINDOW *win, struct Tetromino * const t, int offset_y, int
 
 void draw_board(WINDOW *win, int top_left_y, int top_left_x, int height, int width);
 
-void animate_drop(WINDOW *win, int row);
+void animate_clear(WINDOW *win, const int *rows, int num_rows);
+
+void highlight_rows(WINDOW *win, const int *rows, int num_rows);
 
 void draw_updated_stats(WINDOW *win, long score, double speed);
 
+void open_game_windows(struct GameWindows *wins);
+
+void refresh_game_windows(struct GameWindows *wins);
+
+void close_game_windows(struct GameWindows *wins);
+
+void draw_frame(struct Frame *frame, uint64_t drawn_seq, WINDOW *board_win, WINDOW *preview_win,
+		WINDOW *side_win);
+
 WINDOW *draw_message_popup(int col_offt, char *msg);
 
 
@@ -279,18 +1564,18 @@ enum GameState title_screen(void);
 /**
  * Visualise the top-10 rankings
  */
-enum GameState score_screen(struct Ranking rankings[]);
+enum GameState score_screen(struct Leaderboard *leaderboard, struct ScoreIndex *scores);
 
 
 /**
  * The main phase, where the gameplay takes place
  */
-enum GameState game_screen(struct Ranking rankings[]);
+enum GameState game_screen(struct Session *session, bool resume);
 
 /**
  * Gameover popup that appears after losing the game
  */
-enum GameState manage_gameover(void);
+enum GameState manage_gameover(long rank, long total);
 
 /**
  * NOT IMPLEMENTED: popup that asks whether to keep a savefile with the rankings
@@ -299,4 +1584,13 @@ void query_save_scores(void);
 
 
 
+/*
+ * Command line
+ */
+
+
+void parse_options(int argc, char *argv[]);
+
+
+
 #endif	/* H_TETRODROPPER_H */